@@ -0,0 +1,514 @@
+// Headless benchmark of the simulation passes.
+// Runs fixed drape scenarios for a number of steps, and reports the time spent
+// in each phase, in nanoseconds per particle per step.
+// The phases come from the profiler zones of Simulation::step, and read as
+// zero when the zones are compiled out; the total is always measured.
+// --record and --verify compare the final states of two builds, for instance
+// with and without PHYSIM_COMPACT_PARTICLES.
+// --hash-keys compares the keys of the flat hash instead, on the same drapes.
+
+#include "physics/Profiler.hpp"
+#include "physics/Simulation.hpp"
+#include "physics/Time.hpp"
+#include "utils/creators.hpp"
+#include "utils/parallel.hpp"
+#include "utils/types.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Small fixed step, so that the stiff springs stay stable in every scenario
+constexpr float BENCH_DELTA_TIME = 1.f / 1000.f;
+constexpr int BENCH_STEPS = 200;
+// Largest difference accepted by --verify, in units of length and velocity.
+// The parallel sums may add in a different order from one run to the next.
+constexpr float VERIFY_TOLERANCE = 1e-4f;
+
+// Zones under "Step"
+constexpr std::array<const char*, 3> PHASES = {
+    "Links prep",
+    "Particles prep",
+    "Particles update",
+};
+
+struct Scenario {
+    int n;
+    DrapeAnchors anchors;
+    bool density;
+};
+
+struct Options {
+    int steps = BENCH_STEPS;
+    std::vector<int> sizes = {16, 32, 64, 128};
+    SolverMode solver = SolverMode::Explicit;
+    Density::Backend backend = Density::Backend::SortedGrid;
+    std::string trace;
+    std::string record; // Final states written there
+    std::string verify; // Final states compared to a recorded file
+    int threads = 0; // 0 keeps the pool size
+    bool hashKeys = false;
+};
+
+static void usage(const char* program) {
+    std::fprintf(
+        stderr, "Usage: %s [--steps N] [--sizes N1,N2,...] "
+                "[--solver explicit|implicit|xpbd] "
+                "[--backend \"hash map\"|\"sorted grid\"|\"flat hash\"] "
+                "[--trace FILE] "
+                "[--threads N] [--record FILE | --verify FILE] "
+                "[--hash-keys]\n",
+        program
+    );
+}
+
+// Finds the value named `name`, whatever its case
+template <typename T>
+static bool parseName(
+    std::string_view name, std::initializer_list<T> values, T& value
+) {
+    for (auto candidate : values) {
+        auto candidateName = to_string(candidate);
+        if (std::ranges::equal(name, candidateName, [](char a, char b) {
+                return std::tolower(a) == std::tolower(b);
+            })) {
+            value = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parseOptions(int argc, const char* argv[], Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--hash-keys") {
+            options.hashKeys = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            return false;
+        if (arg == "--steps") {
+            options.steps = std::atoi(argv[++i]);
+        } else if (arg == "--sizes") {
+            options.sizes.clear();
+            std::stringstream list(argv[++i]);
+            std::string size;
+            while (std::getline(list, size, ',')) {
+                options.sizes.push_back(std::atoi(size.c_str()));
+            }
+        } else if (arg == "--threads") {
+            options.threads = std::atoi(argv[++i]);
+        } else if (arg == "--record") {
+            options.record = argv[++i];
+        } else if (arg == "--verify") {
+            options.verify = argv[++i];
+        } else if (arg == "--trace") {
+            options.trace = argv[++i];
+        } else if (arg == "--solver") {
+            if (!parseName(argv[++i], solver_modes, options.solver))
+                return false;
+        } else if (arg == "--backend") {
+            if (!parseName(argv[++i], density_backends, options.backend))
+                return false;
+        } else {
+            return false;
+        }
+    }
+    return options.steps > 0 && !options.sizes.empty() &&
+           options.threads >= 0 &&
+           (options.record.empty() || options.verify.empty());
+}
+
+// Total time of the first zone named `name`
+static Second zoneTotal(
+    const std::vector<Profiler::Zone>& zones, std::string_view name
+) {
+    auto zone = std::ranges::find(zones, name, &Profiler::Zone::name);
+    return zone == zones.end() ? 0 : zone->total;
+}
+
+// Appends the positions and velocities of the particles to `state`
+static void saveState(
+    const ParticleSystem& particles, std::vector<float>& state
+) {
+    for (std::size_t i = 0; i < particles.size(); ++i) {
+        auto position = pointToVec(particles.positions()[i]);
+        auto velocity = translatorToVec(particles.velocities()[i]);
+        state.insert(state.end(), {position.x, position.y, position.z});
+        state.insert(state.end(), {velocity.x, velocity.y, velocity.z});
+    }
+}
+
+static bool writeState(const std::string& path, const std::vector<float>& s) {
+    auto* file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    auto written = std::fwrite(s.data(), sizeof(float), s.size(), file);
+    std::fclose(file);
+    return written == s.size();
+}
+
+static bool readState(const std::string& path, std::vector<float>& state) {
+    auto* file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+    float value;
+    while (std::fread(&value, sizeof(float), 1, file) == 1) {
+        state.push_back(value);
+    }
+    std::fclose(file);
+    return true;
+}
+
+// Compares the final states of a run with the recorded ones
+static bool verifyState(
+    const std::vector<float>& state, const std::vector<float>& reference
+) {
+    if (state.size() != reference.size()) {
+        std::printf(
+            "verify: %zu values recorded, %zu computed\n", reference.size(),
+            state.size()
+        );
+        return false;
+    }
+    float maxError = 0;
+    for (std::size_t i = 0; i < state.size(); ++i) {
+        maxError = std::max(maxError, std::abs(state[i] - reference[i]));
+    }
+    auto ok = maxError <= VERIFY_TOLERANCE;
+    std::printf(
+        "verify: max difference %.3e over %zu values, %s\n", maxError,
+        state.size(), ok ? "ok" : "FAILED"
+    );
+    return ok;
+}
+
+static void run(
+    const Scenario& scenario, const Options& options, std::vector<float>& state
+) {
+    Simulation simulation;
+    simulation.useDensity = scenario.density;
+    simulation.solverMode = options.solver;
+    simulation.density.setBackend(options.backend);
+    simulation.reset(
+        {scenario.n, MASS, KNOT, scenario.anchors, DrapeDirection::XY}
+    );
+
+    auto& profiler = Profiler::instance();
+    profiler.reset();
+    auto steps = options.steps;
+    Time time;
+    for (int step = 0; step < steps; ++step) {
+        simulation.step(BENCH_DELTA_TIME);
+        // Keeps the per-thread buffers small
+        profiler.collect();
+    }
+    time.tick();
+    saveState(simulation.particles, state);
+
+    auto zones = profiler.zones();
+    auto perParticleStep =
+        1e9 / (double(simulation.particles.size()) * double(steps));
+    std::printf(
+        "%5d %9zu %-14s %-4s", scenario.n, simulation.particles.size(),
+        to_string(scenario.anchors).c_str(), scenario.density ? "on" : "off"
+    );
+    for (auto phase : PHASES) {
+        std::printf(" %16.2f", zoneTotal(zones, phase) * perParticleStep);
+    }
+    std::printf(" %16.2f", time.elapsedTime() * perParticleStep);
+    if (scenario.density)
+        std::printf(" %9zu", simulation.density.memoryUsage() / 1024);
+    else
+        std::printf(" %9s", "-");
+    if (options.solver == SolverMode::Implicit) {
+        std::printf(
+            " %6d %10.2e", simulation.implicitSolver.iterations(),
+            simulation.implicitSolver.residual()
+        );
+    }
+    std::printf("\n");
+}
+
+// Open addressing table from 64 bits keys to the particles that have them,
+// as in the flat hash of Density
+class KeyTable {
+public:
+    using uint = unsigned int;
+
+    void build(const std::vector<std::uint64_t>& keys) {
+        std::size_t capacity = 16;
+        while (capacity < keys.size() * 2) {
+            capacity *= 2;
+        }
+        _keys.assign(capacity, EMPTY);
+        _first.assign(capacity + 1, 0);
+        _slots.resize(keys.size());
+        for (uint i = 0; i < keys.size(); ++i) {
+            auto s = _probe(keys[i]);
+            _keys[s] = keys[i];
+            ++_first[s + 1];
+            _slots[i] = uint(s);
+        }
+        for (std::size_t s = 0; s < capacity; ++s) {
+            _first[s + 1] += _first[s];
+        }
+        auto cursor = _first;
+        sorted.resize(keys.size());
+        for (uint i = 0; i < keys.size(); ++i) {
+            sorted[cursor[_slots[i]]++] = i;
+        }
+    }
+
+    // Sorts the particles of each key
+    template <typename Less>
+    void sortEachKey(Less less) {
+        for (std::size_t s = 0; s + 1 < _first.size(); ++s) {
+            auto begin = sorted.begin();
+            std::sort(begin + _first[s], begin + _first[s + 1], less);
+        }
+    }
+
+    // Range of `sorted` that holds the particles of the key
+    std::pair<uint, uint> find(std::uint64_t key) {
+        auto s = _probe(key);
+        if (_keys[s] == EMPTY)
+            return {0, 0};
+        return {_first[s], _first[s + 1]};
+    }
+
+    std::vector<uint> sorted;
+    std::size_t probes = 0;
+
+private:
+    static constexpr std::uint64_t EMPTY = ~std::uint64_t(0);
+    std::vector<std::uint64_t> _keys;
+    std::vector<uint> _first;
+    std::vector<uint> _slots;
+
+    std::size_t _probe(std::uint64_t key) {
+        // Finalizer of MurmurHash3
+        auto h = key;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccd;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53;
+        h ^= h >> 33;
+        auto mask = _keys.size() - 1;
+        auto s = h & mask;
+        for (++probes; _keys[s] != key && _keys[s] != EMPTY; ++probes) {
+            s = (s + 1) & mask;
+        }
+        return s;
+    }
+};
+
+static std::uint64_t packCell(const glm::ivec3& c) {
+    constexpr std::uint64_t bias = 1 << 20;
+    constexpr std::uint64_t mask = (1u << 21) - 1;
+    return ((std::uint64_t(c.x) + bias) & mask) |
+           ((std::uint64_t(c.y) + bias) & mask) << 21 |
+           ((std::uint64_t(c.z) + bias) & mask) << 42;
+}
+
+static std::uint64_t packRow(const glm::ivec3& c) {
+    constexpr std::uint64_t bias = 1 << 30;
+    constexpr std::uint64_t mask = (1u << 31) - 1;
+    return ((std::uint64_t(c.y) + bias) & mask) |
+           ((std::uint64_t(c.z) + bias) & mask) << 31;
+}
+
+// Builds a table keyed by cells and one keyed by rows of cells along x over
+// a drape after `steps` steps, then looks the neighbors of every particle up
+// in both. A cell key costs a probe per cell of the cube around a particle,
+// and a row key a probe per row of its square, plus a search along x. The
+// drape has about one particle per cell, so most of the cell probes find
+// nothing.
+static void runHashKeys(const Scenario& scenario, const Options& options) {
+    Simulation simulation;
+    simulation.reset(
+        {scenario.n, MASS, KNOT, scenario.anchors, DrapeDirection::XY}
+    );
+    for (int step = 0; step < options.steps; ++step) {
+        simulation.step(BENCH_DELTA_TIME);
+    }
+    const auto& density = simulation.density;
+    auto positions = simulation.particles.positions();
+    auto count = positions.size();
+    auto radius = density.lookupRadius;
+    auto h = static_cast<int>(std::ceil(radius / density.gridCellSize));
+    std::vector<glm::ivec3> cells(count);
+    std::vector<std::uint64_t> keys(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        cells[i] = density.cell(positions[i]);
+    }
+
+    const auto near = [&](const kln::point& p, unsigned int j) {
+        return (p & positions[j]).norm() <= radius;
+    };
+    const auto report = [&](const char* name, Second build, Second queries,
+                            const KeyTable& table, std::size_t found) {
+        auto perParticle = 1e9 / double(count);
+        std::printf(
+            "%5d %9zu %-14s %-5s %12.2f %12.2f %10.1f %10.1f\n", scenario.n,
+            count, to_string(scenario.anchors).c_str(), name,
+            build * perParticle, queries * perParticle,
+            double(table.probes) / double(count),
+            double(found) / double(count)
+        );
+    };
+
+    KeyTable byCell;
+    Time time;
+    for (std::size_t i = 0; i < count; ++i) {
+        keys[i] = packCell(cells[i]);
+    }
+    byCell.build(keys);
+    time.tick();
+    auto build = time.deltaTime();
+    byCell.probes = 0;
+    std::size_t found = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        auto c = cells[i];
+        for (int dz = -h; dz <= h; ++dz) {
+            for (int dy = -h; dy <= h; ++dy) {
+                for (int dx = -h; dx <= h; ++dx) {
+                    auto [first, last] =
+                        byCell.find(packCell(c + glm::ivec3(dx, dy, dz)));
+                    for (auto t = first; t < last; ++t) {
+                        found += near(positions[i], byCell.sorted[t]);
+                    }
+                }
+            }
+        }
+    }
+    time.tick();
+    report("cells", build, time.deltaTime(), byCell, found);
+
+    // Same table, with the particles of each row sorted by x
+    KeyTable byRow;
+    std::vector<int> sortedX(count);
+    time.tick();
+    for (std::size_t i = 0; i < count; ++i) {
+        keys[i] = packRow(cells[i]);
+    }
+    byRow.build(keys);
+    byRow.sortEachKey([&](unsigned a, unsigned b) {
+        return cells[a].x < cells[b].x;
+    });
+    for (std::size_t t = 0; t < count; ++t) {
+        sortedX[t] = cells[byRow.sorted[t]].x;
+    }
+    time.tick();
+    build = time.deltaTime();
+    byRow.probes = 0;
+    found = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        auto c = cells[i];
+        for (int dz = -h; dz <= h; ++dz) {
+            for (int dy = -h; dy <= h; ++dy) {
+                auto [first, last] =
+                    byRow.find(packRow(c + glm::ivec3(0, dy, dz)));
+                auto x = sortedX.begin();
+                auto lo = std::lower_bound(x + first, x + last, c.x - h);
+                auto hi = std::upper_bound(lo, x + last, c.x + h);
+                for (auto t = lo; t < hi; ++t) {
+                    found += near(positions[i], byRow.sorted[t - x]);
+                }
+            }
+        }
+    }
+    time.tick();
+    report("rows", build, time.deltaTime(), byRow, found);
+}
+
+int main(int argc, const char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    auto& pool = ThreadPool::instance();
+    if (options.threads > 0)
+        pool.setThreadCount(options.threads);
+
+    if (options.hashKeys) {
+        std::printf(
+            "Flat hash keys after %d steps, ns/particle and per particle\n",
+            options.steps
+        );
+        std::printf(
+            "%5s %9s %-14s %-5s %12s %12s %10s %10s\n", "N", "particles",
+            "anchors", "keys", "build", "queries", "probes", "neighbors"
+        );
+        for (auto n : options.sizes) {
+            for (auto anchors :
+                 {DrapeAnchors::TwoCorners2, DrapeAnchors::Edges}) {
+                runHashKeys({n, anchors, true}, options);
+            }
+        }
+        return 0;
+    }
+
+    std::printf(
+        "ns/particle/step over %d steps, %s solver, %s, %u threads\n",
+        options.steps, to_string(options.solver).c_str(),
+        to_string(options.backend).c_str(), pool.threadCount()
+    );
+    std::printf("%5s %9s %-14s %-4s", "N", "particles", "anchors", "avoid");
+    for (auto phase : PHASES) {
+        std::printf(" %16s", phase);
+    }
+    std::printf(" %16s %9s", "Total", "avoid KB");
+    if (options.solver == SolverMode::Implicit) {
+        std::printf(" %6s %10s", "CG its", "residual");
+    }
+    std::printf("\n");
+
+    // One trace frame per step, until the end of the last scenario
+    auto& profiler = Profiler::instance();
+    profiler.setThreadName("Bench");
+    if (!options.trace.empty()) {
+        auto frames = std::numeric_limits<int>::max();
+        if (!profiler.startCapture(options.trace, frames)) {
+            std::fprintf(stderr, "Can't write %s\n", options.trace.c_str());
+            return 1;
+        }
+    }
+
+    std::vector<float> reference;
+    if (!options.verify.empty() && !readState(options.verify, reference)) {
+        std::fprintf(stderr, "Can't read %s\n", options.verify.c_str());
+        return 1;
+    }
+
+    std::vector<float> state;
+    for (auto n : options.sizes) {
+        for (auto anchors : {DrapeAnchors::TwoCorners2, DrapeAnchors::Edges}) {
+            for (auto density : {true, false}) {
+                run({n, anchors, density}, options, state);
+            }
+        }
+    }
+    profiler.stopCapture();
+
+    if (!options.record.empty() && !writeState(options.record, state)) {
+        std::fprintf(stderr, "Can't write %s\n", options.record.c_str());
+        return 1;
+    }
+    if (!options.verify.empty() && !verifyState(state, reference))
+        return 1;
+    return 0;
+}
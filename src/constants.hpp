@@ -1,13 +1,30 @@
 #pragma once
 
+#include "klein/plane.hpp"
 #include "klein/point.hpp"
 
+#include <cstddef>
+
 const float WIDTH = 1280.f;
 const float HEIGHT = 960.f;
 
 const float NEAR = 0.1f;
 const float FAR = 1000.f;
 
+// Fixed time step of the physics, and the most steps run per wake-up
+const double PHYSICS_DELTA_TIME = 1. / 1000.;
+const double MIN_PHYSICS_DELTA_TIME = 1e-5;
+const int PHYSICS_MAX_SUBSTEPS = 16;
+
+// Constraint passes per step of the position based solver, and the factor of
+// its averaged corrections in Jacobi mode
+const int XPBD_ITERATIONS = 10;
+const float XPBD_JACOBI_RELAXATION = 1.5f;
+
+// Default length and file of the profiler trace captures
+const int TRACE_FRAMES = 300;
+const char* const TRACE_PATH = "physim-trace.json";
+
 const int N = 16;
 const float KNOT = 1.f;
 const float STIFF = 3000.f;
@@ -15,6 +32,9 @@ const float MASS = 1.f;
 const float VISCOSITY = 2.5f;
 const float GRAVITY = 5.0f;
 
+const kln::plane GROUND(0, 1, 1, 15);
+const float GROUND_FORCE = 100.f;
+
 const float PINCH_FORCE = 100000.0f;
 
 const float POINT_SIZE = 0.05f;
@@ -24,6 +44,24 @@ const float PLANE_SIZE = 100.0f;
 const float DENSITY_REPULSION = 500.f;
 const float DENSITY_LOOKUP_RADIUS = 2.f;
 const float DENSITY_GRID_SIZE = 1.f;
+// The neighbor lists are rebuilt once a particle has moved by half of it
+const float DENSITY_SKIN = 0.5f;
+
+// Steps between two checks of the particle order in memory
+const int REORDER_INTERVAL = 500;
+// The particles are sorted again along the Z-order curve once this fraction
+// of their neighbors along the curve are further than REORDER_NEAR indices
+const float REORDER_THRESHOLD = 0.25f;
+const std::size_t REORDER_NEAR = 64;
+
+// A group of particles connected by springs falls asleep once each of them
+// has kept a kinetic energy per unit mass under SLEEP_ENERGY for SLEEP_DELAY
+// seconds
+const float SLEEP_ENERGY = 1e-3f;
+const float SLEEP_DELAY = 1.f;
+// It wakes up once gravity and wind differ by more than SLEEP_DRIFT from
+// their sum when it fell asleep
+const float SLEEP_DRIFT = 0.1f;
 
 const kln::point WIND_AMP(0, 10, 10);
 const kln::point WIND_FREQ(0, 5, 0.5);
@@ -1,4 +1,5 @@
 #include "mesh.hpp"
+#include "physics/Profiler.hpp"
 #include <stdexcept>
 
 Mesh::Mesh(
@@ -143,6 +144,7 @@ Mesh& Mesh::draw() noexcept {
 }
 
 Mesh& Mesh::drawInstanced(const std::vector<Instance>& instances) noexcept {
+    PROFILE_ZONE("Mesh::drawInstanced");
     glBindBuffer(GL_ARRAY_BUFFER, _instanceVbo);
     glBufferData(
         GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), instances.data(),
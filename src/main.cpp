@@ -8,6 +8,8 @@
 #include "physics/density.hpp"
 #include "utils/shapes.hpp"
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <mutex>
 #include <ranges>
 #include <thread>
@@ -23,7 +25,9 @@
 #include "physics/physics.hpp"
 #include "rendering/Camera.hpp"
 #include "rendering/Displayator.hpp"
+#include "utils/buffers.hpp"
 #include "utils/creators.hpp"
+#include "utils/parallel.hpp"
 #include "utils/types.hpp"
 
 #include <glm/gtc/matrix_transform.hpp>
@@ -67,42 +71,23 @@ int main(int argc, const char* argv[]) {
 
     float angle = 0.0f;
     bool isHolding = false;
-    int nextCount = N;
+    std::atomic<int> nextCount = N;
     float gravityForce = GRAVITY;
     DrapeAnchors anchors = DrapeAnchors::TwoCorners2;
     DrapeDirection direction = DrapeDirection::XY;
 
     glm::vec3 pinchDirection = {0, 1, 0};
     float pinchForce = PINCH_FORCE;
-    int pinchIndex = 0;
+    std::atomic<int> pinchIndex = 0;
 
     glm::vec4 groundFactors = {0, 1, 1, 15};
 
-    unsigned int threads = std::thread::hardware_concurrency();
-
-    struct PhysicsData {
-        std::vector<Particle> particles;
-        std::vector<SpringLink> links;
-        Wall ground;
-        ConstantForce gravity;
-        Spring spring {KNOT, STIFF, VISCOSITY};
-        Density density {
-            DENSITY_REPULSION, DENSITY_LOOKUP_RADIUS, DENSITY_GRID_SIZE
-        };
-        Wind wind {
-            WIND_FREQ,
-            WIND_AMP,
-        };
+    auto& pool = ThreadPool::instance();
+    int threads = pool.threadCount();
 
+    struct PhysicsData : Simulation {
         std::mutex mutex;
-    } pd {
-        .ground =
-            {kln::plane(
-                 groundFactors.x, groundFactors.y, groundFactors.z,
-                     groundFactors.w
-             ), 100.f},
-        .gravity = {kln::translator(gravityForce, 0, -1, 0)}
-    };
+    } pd;
     // auto& particles = pd.particles;
     // auto& links = pd.links;
     // auto& ground = pd.ground;
@@ -110,28 +95,30 @@ int main(int argc, const char* argv[]) {
     // auto& spring = pd.spring;
     // auto& density = pd.density;
 
-    struct RenderData {
+    // Everything the render loop draws, published once per physics wake-up
+    struct RenderFrame {
         std::vector<glm::vec3> points;
         std::vector<std::pair<glm::vec3, glm::vec3>> lines;
-        Density density;
-
-        std::mutex mutex;
-    } rd;
-
-    auto& points = rd.points;
-    auto& lines = rd.lines;
+        // Indices of the particles around the pinched one
+        std::vector<std::size_t> neighbors;
+
+        int pinchIndex = 0;
+        kln::point pinchPosition;
+        kln::translator pinchVelocity;
+        std::size_t awakeParticles = 0;
+        int solverIterations = 0;
+        float solverResidual = 0;
+    };
+    TripleBuffer<RenderFrame> frames;
 
     float mass = MASS;
     const auto reset = [&] {
-        pd.particles.clear();
-        pd.links.clear();
-        drape(
-            pd.particles, pd.links, {nextCount, mass, KNOT, anchors, direction}
-        );
-        points.resize(pd.particles.size());
-        lines.resize(pd.links.size());
-        pinchIndex = nextCount * (nextCount + 1) / 2;
-        pd.density.setParticles(pd.particles);
+        int count = nextCount;
+        pd.reset({count, mass, KNOT, anchors, direction});
+        // The middle of the drape, wherever the reset put it
+        auto remap = pd.remap();
+        auto middle = std::size_t(count * (count + 1) / 2);
+        pinchIndex = remap[std::min(middle, remap.size() - 1)];
     };
     reset();
 
@@ -191,100 +178,123 @@ int main(int argc, const char* argv[]) {
 
     bool terminate = false;
     bool callReset = false;
-    float physicsDeltatime;
-    std::vector<float> profilingData(5);
+    StepScheduler scheduler(PHYSICS_DELTA_TIME, PHYSICS_MAX_SUBSTEPS);
     auto physicsThread = std::thread([&] {
+        Profiler::instance().setThreadName("Physics");
         auto& particles = pd.particles;
         auto& links = pd.links;
-        auto& ground = pd.ground;
-        auto& gravity = pd.gravity;
-        auto& spring = pd.spring;
-        auto& density = pd.density;
-        auto& wind = pd.wind;
 
-        Profiler profiler;
+        // Positions before and after the last step, to interpolate between
+        std::vector<glm::vec3> previousPoints;
+        std::vector<glm::vec3> currentPoints;
+        const auto capture = [&](std::vector<glm::vec3>& out) {
+            auto positions = particles.positions();
+            out.resize(positions.size());
+            parallelFor(positions.size(), [&](std::size_t i) {
+                out[i] = pointToVec(positions[i]);
+            });
+        };
+
         Time time;
         while (!terminate) {
-            float delta = time.deltaTime();
-            physicsDeltatime = delta;
+            time.tick();
+            int steps = scheduler.advance(time.deltaTime());
+            if (steps == 0) {
+                std::this_thread::sleep_for(
+                    std::chrono::duration<Second>(scheduler.remaining())
+                );
+                continue;
+            }
+            PROFILE_ZONE("Physics");
 
-            pd.mutex.lock();
+            {
+                PROFILE_ZONE("Lock wait");
+                pd.mutex.lock();
+            }
 
             if (callReset) {
                 reset();
                 callReset = false;
             }
 
-            profiler.begin();
-
-            // Links preparation
-            std::for_each(
-                std::execution::par_unseq, links.begin(), links.end(),
-                [&](auto& link) {
-                    spring.length = link.length;
-                    spring.prepareForce(particles[link.a], particles[link.b]);
+            auto delta = static_cast<float>(scheduler.deltaTime());
+            for (int step = 0; step < steps; ++step) {
+                auto last = step == steps - 1;
+                if (last)
+                    capture(previousPoints);
+                auto reorders = pd.reorders();
+                pd.step(delta);
+                if (pd.reorders() == reorders)
+                    continue;
+
+                // The particles moved in memory, follow them
+                auto remap = pd.remap();
+                pinchIndex = remap[std::min<int>(pinchIndex, remap.size() - 1)];
+                if (last) {
+                    std::vector<glm::vec3> moved(previousPoints.size());
+                    for (std::size_t i = 0; i < remap.size(); ++i) {
+                        moved[remap[i]] = previousPoints[i];
+                    }
+                    previousPoints.swap(moved);
                 }
-            );
-            profiler.tick();
-            // Particles preparation
-            std::for_each(
-                std::execution::par_unseq, particles.begin(), particles.end(),
-                [&](auto& particle) {
-                    gravity.prepareForce(particle);
-                    ground.prepareForce(particle);
-                    wind.prepareForce(particle);
-                    density.prepareForce(particle);
-                }
-            );
-            wind.update(delta);
-            profiler.tick();
-            // Particles update
-            std::for_each(
-                std::execution::par_unseq, particles.begin(), particles.end(),
-                [&](auto& particle) {
-                    particle.updateForce(delta);
-                    particle.update(delta);
-                }
-            );
-            profiler.tick();
+            }
+            capture(currentPoints);
+
+            auto& frame = frames.back();
+            // The UI may have picked an index before a reset shrank the drape
+            frame.pinchIndex =
+                std::min<int>(pinchIndex, int(particles.size()) - 1);
+            frame.pinchPosition = particles[frame.pinchIndex].position;
+            frame.pinchVelocity = particles[frame.pinchIndex].velocity;
+            frame.awakeParticles = pd.sleep.awake();
+            frame.solverIterations = pd.implicitSolver.iterations();
+            frame.solverResidual = pd.implicitSolver.residual();
+            // Only the query result crosses threads, never the grid itself
+            pd.density.nearbyParticles(frame.pinchPosition, frame.neighbors);
 
             pd.mutex.unlock();
-            rd.mutex.lock();
-
-            std::transform(
-                std::execution::par_unseq, particles.begin(), particles.end(),
-                points.begin(),
-                [](const auto& particle) {
-                    return pointToVec(particle.position);
-                }
-            );
-            profiler.tick();
-            std::transform(
-                std::execution::par_unseq, links.begin(), links.end(),
-                lines.begin(),
-                [&](const auto& link) {
-                    return std::pair(
-                        pointToVec(particles[link.a].position),
-                        pointToVec(particles[link.b].position)
-                    );
-                }
-            );
-            profiler.tick();
-            rd.density = pd.density;
-            profiler.tick();
-
-            rd.mutex.unlock();
 
-            for (int i = 0; i < 5; i++) {
-                profilingData[i] = profiler[i];
+            auto& points = frame.points;
+            auto& lines = frame.lines;
+            points.resize(currentPoints.size());
+            lines.resize(links.size());
+            auto alpha = scheduler.alpha();
+            {
+                PROFILE_ZONE("Points transform");
+                parallelFor(points.size(), [&](std::size_t i) {
+                    points[i] =
+                        glm::mix(previousPoints[i], currentPoints[i], alpha);
+                });
+            }
+            {
+                PROFILE_ZONE("Lines transform");
+                parallelFor(lines.size(), [&](std::size_t i) {
+                    const auto& link = links[i];
+                    lines[i] = std::pair(points[link.a], points[link.b]);
+                });
             }
 
-            time.tick();
+            frames.publish();
         }
     });
 
+    Profiler::instance().setThreadName("Render");
+    int traceFrames = TRACE_FRAMES;
+    // The sleeping particles don't notice when the forces change
+    const auto wakeAll = [&] {
+        std::scoped_lock lock(pd.mutex);
+        pd.sleep.wake(pd.particles);
+    };
+    // The physics thread reads the settings during the step: the widgets
+    // edit copies, written back under the lock. Only this thread writes
+    // them, so it reads them without it.
+    const auto assign = [&](auto& field, const auto& value) {
+        std::scoped_lock lock(pd.mutex);
+        field = value;
+    };
     Time time;
     while (!window.shouldClose()) {
+        PROFILE_ZONE("Frame");
         float delta = time.deltaTime();
         angle += time.deltaTime();
 
@@ -300,19 +310,21 @@ int main(int argc, const char* argv[]) {
             .setLineWidth(LINE_SIZE)
             .setPlaneSize(PLANE_SIZE);
 
-        displayator.setColor({1, 1, 1}).drawPoints(points);
-        displayator.setColor({0, 1, 0}).drawLines(lines);
+        frames.fetch();
+        const auto& frame = frames.front();
+
+        displayator.setColor({1, 1, 1}).drawPoints(frame.points);
+        displayator.setColor({0, 1, 0}).drawLines(frame.lines);
 
-        for (auto part :
-             rd.density.nearbyParticles(pd.particles[pinchIndex].position)) {
+        for (auto index : frame.neighbors) {
             displayator.setColor({1, .5, 0})
                 .setPointSize(POINT_SIZE * 1.5)
-                .drawPoint(pointToVec(part->position));
+                .drawPoint(frame.points[index]);
         }
 
         displayator.setColor({1, 0, 0})
             .setPointSize(POINT_SIZE * 2)
-            .drawPoint(pd.particles[pinchIndex].position);
+            .drawPoint(frame.pinchPosition);
 
         // displayator.setLineWidth(LINE_SIZE * 2);
         // for (auto cell : density.nearbyCells(particles[pinchIndex].position))
@@ -346,44 +358,198 @@ int main(int argc, const char* argv[]) {
                 ImGuiWindowFlags_AlwaysAutoResize
         );
         ImGui::SeparatorText("Profiling");
-        ImGui::Text("Nb threads: %d", threads);
+        if (ImGui::InputInt("Nb threads", &threads)) {
+            pool.setThreadCount(std::max(threads, 1));
+            threads = pool.threadCount();
+        }
         ImGui::Text("FPS: %.2f", 1.0f / time.deltaTime());
-        ImGui::Text("Physics FPS: %.2f", 1.0f / physicsDeltatime);
-        ImGui::Text("Links prep      : %.4fms", profilingData[0] * 1000.f);
-        ImGui::Text("Particles prep  : %.4fms", profilingData[1] * 1000.f);
-        ImGui::Text("Particles update: %.4fms", profilingData[2] * 1000.f);
-        ImGui::Text("Points transform: %.4fms", profilingData[3] * 1000.f);
-        ImGui::Text("Lines transform : %.4fms", profilingData[4] * 1000.f);
-        ImGui::Text("Density copy    : %.4fms", profilingData[5] * 1000.f);
-        ImGui::Text("N particles: %lld", pd.particles.size());
-        ImGui::Text("N links: %lld", pd.links.size());
+        ImGui::Text("Physics steps/s: %.0f", scheduler.stepsPerSecond());
+        Profiler::instance().collect();
+        if (auto left = Profiler::instance().captureFrames()) {
+            ImGui::Text("Capturing %s: %d frames left", TRACE_PATH, left);
+        } else {
+            if (ImGui::Button("Capture trace")) {
+                Profiler::instance().startCapture(TRACE_PATH, traceFrames);
+            }
+            ImGui::SameLine();
+            ImGui::InputInt("Frames", &traceFrames);
+        }
+        for (const auto& zone : Profiler::instance().zones()) {
+            // Zones that stopped running keep their last statistics
+            auto indent = zone.depth * 2;
+            if (zone.counter) {
+                ImGui::Text(
+                    "%*s%-*s: %.0f (avg %.1f, p99 %.0f)", indent, "",
+                    20 - indent, zone.name.c_str(), zone.last, zone.average,
+                    zone.p99
+                );
+            } else {
+                ImGui::Text(
+                    "%*s%-*s: %.4fms (min %.4f, p99 %.4f)", indent, "",
+                    20 - indent, zone.name.c_str(), zone.average * 1000.,
+                    zone.min * 1000., zone.p99 * 1000.
+                );
+            }
+        }
+        if (pd.solverMode == SolverMode::Implicit) {
+            ImGui::Text(
+                "CG iterations   : %d (residual %.2e)", frame.solverIterations,
+                frame.solverResidual
+            );
+        }
+        ImGui::Text("N particles: %lld", frame.points.size());
+        ImGui::Text("N links: %lld", frame.lines.size());
+        ImGui::Text("Awake particles: %zu", frame.awakeParticles);
         ImGui::SeparatorText("Simulation");
         if (ImGui::Button("Reset")) {
             callReset = true;
         }
         ImGui::SameLine();
-        ImGui::InputInt("N", &nextCount);
-        ImGui::InputFloat("Stiffness", &pd.spring.stiffness);
-        ImGui::InputFloat("Viscosity", &pd.spring.viscosity);
+        // At least one particle, so that there is always one to pinch
+        int n = nextCount;
+        if (ImGui::InputInt("N", &n)) {
+            nextCount = std::max(n, 1);
+        }
+        // Edited on copies, so that the physics thread only ever sees
+        // clamped values
+        Second timeStep = scheduler.fixedDeltaTime;
+        if (ImGui::InputDouble("Time step", &timeStep, 0, 0, "%.5f")) {
+            scheduler.fixedDeltaTime =
+                std::max(timeStep, MIN_PHYSICS_DELTA_TIME);
+        }
+        int maxSubsteps = scheduler.maxSubsteps;
+        if (ImGui::InputInt("Max substeps", &maxSubsteps)) {
+            scheduler.maxSubsteps = std::max(maxSubsteps, 1);
+        }
+        float stiffness = pd.spring.stiffness;
+        float viscosity = pd.spring.viscosity;
+        bool materialChanged = ImGui::InputFloat("Stiffness", &stiffness);
+        materialChanged |= ImGui::InputFloat("Viscosity", &viscosity);
+        if (materialChanged) {
+            std::scoped_lock lock(pd.mutex);
+            pd.spring.stiffness = stiffness;
+            pd.spring.viscosity = viscosity;
+            pd.adjacency.setMaterial(stiffness, viscosity);
+            pd.sleep.wake(pd.particles);
+        }
+        if (ImGui::BeginCombo("Springs", to_string(pd.springMode).c_str())) {
+            for (const auto& mode : spring_modes) {
+                if (ImGui::Selectable(
+                        to_string(mode).c_str(), mode == pd.springMode
+                    )) {
+                    assign(pd.springMode, mode);
+                }
+            }
+            ImGui::EndCombo();
+        }
+        if (ImGui::BeginCombo("Solver", to_string(pd.solverMode).c_str())) {
+            for (const auto& mode : solver_modes) {
+                if (ImGui::Selectable(
+                        to_string(mode).c_str(), mode == pd.solverMode
+                    )) {
+                    assign(pd.solverMode, mode);
+                }
+            }
+            ImGui::EndCombo();
+        }
+        if (pd.solverMode == SolverMode::Implicit) {
+            int iterations = pd.implicitSolver.maxIterations;
+            if (ImGui::InputInt("CG iterations", &iterations)) {
+                assign(pd.implicitSolver.maxIterations, iterations);
+            }
+        }
+        if (pd.solverMode == SolverMode::Position) {
+            int iterations = pd.positionSolver.iterations;
+            if (ImGui::InputInt("XPBD iterations", &iterations)) {
+                assign(pd.positionSolver.iterations, iterations);
+            }
+            if (ImGui::BeginCombo(
+                    "XPBD passes",
+                    to_string(pd.positionSolver.mode).c_str()
+                )) {
+                for (const auto& mode : position_solver_modes) {
+                    if (ImGui::Selectable(
+                            to_string(mode).c_str(),
+                            mode == pd.positionSolver.mode
+                        )) {
+                        assign(pd.positionSolver.mode, mode);
+                    }
+                }
+                ImGui::EndCombo();
+            }
+        }
         if (ImGui::InputFloat("Mass", &mass)) {
-            std::for_each(
-                std::execution::par_unseq, pd.particles.begin(),
-                pd.particles.end(),
-                [&](auto& particle) { particle.mass = mass; }
-            );
+            std::scoped_lock lock(pd.mutex);
+            auto inverseMasses = pd.particles.inverseMasses();
+            parallelFor(inverseMasses.size(), [&](std::size_t i) {
+                inverseMasses[i] = 1.f / mass;
+            });
+            pd.sleep.wake(pd.particles);
         }
         if (ImGui::InputFloat("Gravity", &gravityForce)) {
-            pd.gravity.force = kln::translator(gravityForce, 0, -1, 0);
+            assign(pd.gravity.force, kln::translator(gravityForce, 0, -1, 0));
+            wakeAll();
+        }
+        bool useDensity = pd.useDensity;
+        if (ImGui::Checkbox("Avoid", &useDensity)) {
+            assign(pd.useDensity, useDensity);
+        }
+        float repulsion = pd.density.repulsionFactor;
+        if (ImGui::InputFloat("Avoid force", &repulsion)) {
+            assign(pd.density.repulsionFactor, repulsion);
+        }
+        if (ImGui::BeginCombo(
+                "Avoid grid", to_string(pd.density.backend()).c_str()
+            )) {
+            for (const auto& backend : density_backends) {
+                if (ImGui::Selectable(
+                        to_string(backend).c_str(),
+                        backend == pd.density.backend()
+                    )) {
+                    std::scoped_lock lock(pd.mutex);
+                    pd.density.setBackend(backend);
+                }
+            }
+            ImGui::EndCombo();
+        }
+        float lookupRadius = pd.density.lookupRadius;
+        if (ImGui::InputFloat("Avoid radius", &lookupRadius)) {
+            assign(pd.density.lookupRadius, lookupRadius);
+        }
+        float skin = pd.density.skin;
+        if (ImGui::InputFloat("Avoid skin", &skin)) {
+            assign(pd.density.skin, skin);
+        }
+        bool pairwise = pd.density.pairwise;
+        if (ImGui::Checkbox("Avoid pairs", &pairwise)) {
+            assign(pd.density.pairwise, pairwise);
+        }
+        int reorderInterval = pd.reorderInterval;
+        if (ImGui::InputInt("Reorder interval", &reorderInterval)) {
+            assign(pd.reorderInterval, reorderInterval);
+        }
+        bool sleep = pd.sleep.enabled;
+        if (ImGui::Checkbox("Sleep", &sleep)) {
+            assign(pd.sleep.enabled, sleep);
+        }
+        if (sleep && pointToVec(pd.wind.amplitude) != glm::vec3(0)) {
+            // The default wind never settles, so nothing would ever sleep
+            ImGui::SameLine();
+            ImGui::TextDisabled("(needs a wind amplitude of 0)");
+        }
+        float energy = pd.sleep.energy;
+        if (ImGui::InputFloat("Sleep energy", &energy, 0.f, 0.f, "%.1e")) {
+            assign(pd.sleep.energy, energy);
         }
-        ImGui::InputFloat("Avoid force", &pd.density.repulsionFactor);
-        ImGui::InputFloat("Avoid radius", &pd.density.lookupRadius);
         glm::vec3 freq = pointToVec(pd.wind.frequency);
         glm::vec3 amp = pointToVec(pd.wind.amplitude);
         if (ImGui::InputFloat3("Wind frequency", glm::value_ptr(freq))) {
-            pd.wind.frequency = vecToPoint(freq);
+            assign(pd.wind.frequency, vecToPoint(freq));
+            wakeAll();
         }
         if (ImGui::InputFloat3("Wind amplitude", glm::value_ptr(amp))) {
-            pd.wind.amplitude = vecToPoint(amp);
+            assign(pd.wind.amplitude, vecToPoint(amp));
+            wakeAll();
         }
         if (ImGui::BeginCombo("Anchors", to_string(anchors).c_str())) {
             for (const auto& anchor : drape_anchors) {
@@ -407,30 +573,27 @@ int main(int argc, const char* argv[]) {
                 ImGuiWindowFlags_AlwaysAutoResize
         );
         ImGui::SeparatorText("Particle observer");
-        if (ImGui::InputInt("Particle index", &pinchIndex)) {
-            pinchIndex =
-                (pinchIndex + pd.particles.size()) % pd.particles.size();
+        int nextPinchIndex = frame.pinchIndex;
+        if (ImGui::InputInt("Particle index", &nextPinchIndex) &&
+            !frame.points.empty()) {
+            int count = frame.points.size();
+            pinchIndex = (nextPinchIndex + count) % count;
         }
         ImGui::Text(
             "Position: % 3.2f e013 + % 3.2f e021 + % 3.2f e032 + % 3.2f e123",
-            pd.particles[pinchIndex].position.e013(),
-            pd.particles[pinchIndex].position.e021(),
-            pd.particles[pinchIndex].position.e032(),
-            pd.particles[pinchIndex].position.e123()
+            frame.pinchPosition.e013(), frame.pinchPosition.e021(),
+            frame.pinchPosition.e032(), frame.pinchPosition.e123()
         );
         ImGui::Text("Velocity:");
         ImGui::Text(
             "% 3.2f + % 3.2f e01 + % 3.2f e02 + % 3.2f e03",
-            pd.particles[pinchIndex].velocity.scalar(),
-            pd.particles[pinchIndex].velocity.e01(),
-            pd.particles[pinchIndex].velocity.e02(),
-            pd.particles[pinchIndex].velocity.e03()
+            frame.pinchVelocity.scalar(), frame.pinchVelocity.e01(),
+            frame.pinchVelocity.e02(), frame.pinchVelocity.e03()
         );
         ImGui::Text(
             "      + % 3.2f e10 + % 3.2f e20 + % 3.2f e30",
-            pd.particles[pinchIndex].velocity.e10(),
-            pd.particles[pinchIndex].velocity.e20(),
-            pd.particles[pinchIndex].velocity.e30()
+            frame.pinchVelocity.e10(), frame.pinchVelocity.e20(),
+            frame.pinchVelocity.e30()
         );
         glm::vec3 pinchDirectionNormalized;
         ImGui::SliderFloat3(
@@ -444,9 +607,13 @@ int main(int argc, const char* argv[]) {
         );
         ImGui::InputFloat("Pinch force", &pinchForce);
         if (ImGui::Button("Pinch")) {
-            pd.particles[pinchIndex].applyForce(
-                pinchForceVec, time.deltaTime()
-            );
+            std::scoped_lock lock(pd.mutex);
+            if (std::size_t(pinchIndex) < pd.particles.size()) {
+                pd.particles[pinchIndex].applyForce(
+                    pinchForceVec, time.deltaTime()
+                );
+                pd.sleep.wake(pd.particles, pinchIndex);
+            }
         }
         ImGui::Text("Pinch force: ");
         ImGui::Text(
@@ -466,13 +633,17 @@ int main(int argc, const char* argv[]) {
             ImGui::SliderFloat("e1", &groundFactors.y, -1.f, 1.f) ||
             ImGui::SliderFloat("e2", &groundFactors.z, -1.f, 1.f) ||
             ImGui::SliderFloat("e3", &groundFactors.w, -15.f, 15.f)) {
-            pd.ground.wall = kln::plane(
+            kln::plane wall(
                 groundFactors.x, groundFactors.y, groundFactors.z,
                 groundFactors.w
             );
+            assign(pd.ground.wall, wall);
+            wakeAll();
         }
-        if (ImGui::InputFloat("Ground force", &pd.ground.force)) {
-            pd.ground.force = pd.ground.force;
+        float groundForce = pd.ground.force;
+        if (ImGui::InputFloat("Ground force", &groundForce)) {
+            assign(pd.ground.force, groundForce);
+            wakeAll();
         }
         ImGui::End();
 
@@ -481,7 +652,11 @@ int main(int argc, const char* argv[]) {
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
         glfw::pollEvents();
-        window.swapBuffers();
+        {
+            // Mostly the wait for the vertical sync
+            PROFILE_ZONE("Swap buffers");
+            window.swapBuffers();
+        }
         time.tick();
     }
 
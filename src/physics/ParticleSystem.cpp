@@ -0,0 +1,67 @@
+#include "ParticleSystem.hpp"
+#include <algorithm>
+#include <type_traits>
+
+void ParticleSystem::clear() {
+    _positions.clear();
+    _velocities.clear();
+    _forces.clear();
+    _inverseMasses.clear();
+    _locks.clear();
+    _staticCount = 0;
+}
+
+void ParticleSystem::reserve(std::size_t count) {
+    _positions.reserve(count);
+    _velocities.reserve(count);
+    _forces.reserve(count);
+    _inverseMasses.reserve(count);
+    _locks.reserve(count);
+}
+
+Particle ParticleSystem::emplace_back(const kln::point& position, float mass) {
+    _positions.push_back(position);
+    _velocities.emplace_back();
+    _forces.emplace_back();
+    _inverseMasses.push_back(1.f / mass);
+    _locks.push_back(false);
+    return back();
+}
+
+Particle ParticleSystem::operator[](std::size_t index) {
+    return {
+        _positions[index],     _velocities[index], _forces[index],
+        _inverseMasses[index], _locks[index],
+    };
+}
+
+void ParticleSystem::permute(std::span<const unsigned int> order) {
+    const auto gather = [&](auto& values) {
+        std::remove_reference_t<decltype(values)> sorted(values.size());
+        parallelFor(order.size(), [&](std::size_t k) {
+            sorted[k] = values[order[k]];
+        });
+        values.swap(sorted);
+    };
+    gather(_positions);
+    gather(_velocities);
+    gather(_forces);
+    gather(_inverseMasses);
+    gather(_locks);
+    auto dynamic = std::ranges::find_if(_locks, [](std::uint8_t lock) {
+        return !(lock & LOCK_PINNED);
+    });
+    _staticCount = dynamic - _locks.begin();
+}
+
+void ParticleSystem::_clearStatic() {
+    // Springs and pinches may still reach a static particle
+    std::fill_n(_velocities.begin(), _staticCount, Motion {});
+    std::fill_n(_forces.begin(), _staticCount, Motion {});
+}
+
+void ParticleSystem::integrate(const Second& deltaTime) {
+    integrate(deltaTime, [](std::size_t, const kln::point&) {
+        return kln::translator {};
+    });
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "../utils/memory.hpp"
+#include "../utils/parallel.hpp"
+#include "Time.hpp"
+#include "base.hpp"
+
+#include <cstdint>
+#include <klein/klein.hpp>
+#include <span>
+#include <vector>
+
+// Structure-of-arrays storage of the particles.
+// Each attribute lives in its own cache-aligned array, so that the passes
+// which only need a few of them stream through contiguous memory.
+class ParticleSystem {
+public:
+    ParticleSystem() = default;
+
+    std::size_t size() const { return _positions.size(); }
+    bool empty() const { return _positions.empty(); }
+
+    void clear();
+    void reserve(std::size_t count);
+    Particle emplace_back(const kln::point& position = {}, float mass = 1.f);
+
+    Particle operator[](std::size_t index);
+    Particle back() { return (*this)[size() - 1]; }
+
+    // Moves the particle order[k] to the index k, for every k
+    void permute(std::span<const unsigned int> order);
+    // Number of pinned particles at the front, as left by the last permute.
+    // They never move, so the passes over the particles start after them.
+    std::size_t staticCount() const { return _staticCount; }
+
+    // Applies the prepared forces, then moves every dynamic particle that no
+    // lock holds
+    void integrate(const Second& deltaTime);
+    // Same, adding the acceleration field(index, position) of each particle
+    // in the same sweep
+    template <typename Field>
+    void integrate(const Second& deltaTime, const Field& field);
+    // Adds the acceleration field(index, position) to the prepared forces of
+    // the dynamic particles that no lock holds
+    template <typename Field>
+    void prepareForces(const Field& field);
+
+    std::span<kln::point> positions() { return _positions; }
+    std::span<const kln::point> positions() const { return _positions; }
+    std::span<Motion> velocities() { return _velocities; }
+    std::span<const Motion> velocities() const { return _velocities; }
+    std::span<Motion> forces() { return _forces; }
+    std::span<float> inverseMasses() { return _inverseMasses; }
+    std::span<const float> inverseMasses() const { return _inverseMasses; }
+    std::span<std::uint8_t> locks() { return _locks; }
+    std::span<const std::uint8_t> locks() const { return _locks; }
+
+private:
+    AlignedVector<kln::point> _positions;
+    AlignedVector<Motion> _velocities;
+    AlignedVector<Motion> _forces;
+    AlignedVector<float> _inverseMasses;
+    AlignedVector<std::uint8_t> _locks;
+    std::size_t _staticCount = 0;
+
+    // Drops what the static particles have received
+    void _clearStatic();
+};
+
+template <typename Field>
+void ParticleSystem::integrate(const Second& deltaTime, const Field& field) {
+    auto dt = static_cast<float>(deltaTime);
+    _clearStatic();
+    auto first = _staticCount;
+    auto count = size() - first;
+    parallelChunks("Integrate chunk", count, [&](auto begin, auto end) {
+        for (auto i = first + begin; i < first + end; ++i) {
+            auto& velocity = _velocities[i];
+            if (_locks[i]) {
+                // Asleep: the forces would be thrown away
+                velocity = {};
+                _forces[i] = {};
+                continue;
+            }
+            auto force = _forces[i];
+            force += field(i, _positions[i]);
+            velocity += force * dt;
+            _forces[i] = {};
+
+            _positions[i] = (velocity * dt)(_positions[i]);
+        }
+    });
+}
+
+template <typename Field>
+void ParticleSystem::prepareForces(const Field& field) {
+    auto first = _staticCount;
+    auto count = size() - first;
+    parallelChunks("Forces chunk", count, [&](auto begin, auto end) {
+        for (auto i = first + begin; i < first + end; ++i) {
+            if (!_locks[i])
+                _forces[i] += field(i, _positions[i]);
+        }
+    });
+}
@@ -0,0 +1,228 @@
+#include "Profiler.hpp"
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+Profiler& Profiler::instance() {
+    static Profiler profiler;
+    return profiler;
+}
+
+Second Profiler::now() {
+    using Clock = std::chrono::steady_clock;
+    static const auto start = Clock::now();
+    return std::chrono::duration<Second>(Clock::now() - start).count();
+}
+
+Profiler::ThreadBuffer& Profiler::_buffer() {
+    // Shared with the profiler, so that the records outlive the thread
+    thread_local std::shared_ptr<ThreadBuffer> buffer;
+    if (!buffer) {
+        buffer = std::make_shared<ThreadBuffer>();
+        std::scoped_lock lock(_mutex);
+        buffer->id = int(_buffers.size());
+        buffer->name = "Thread " + std::to_string(buffer->id);
+        _buffers.push_back(buffer);
+    }
+    return *buffer;
+}
+
+int Profiler::_zone(ThreadBuffer& buffer, const char* name, bool counter) {
+    auto parent = buffer.stack.empty() ? -1 : buffer.stack.back();
+    // Each thread caches the ids it has seen, to skip the shared lock
+    auto [cached, inserted] = buffer.zones.try_emplace({parent, name}, -1);
+    if (!inserted)
+        return cached->second;
+
+    std::scoped_lock lock(_mutex);
+    auto [it, created] =
+        _nodeIds.try_emplace({parent, name}, int(_nodes.size()));
+    if (created) {
+        auto depth = parent < 0 ? 0 : _nodes[parent].depth + 1;
+        _nodes.push_back({name, parent, depth, counter});
+    }
+    cached->second = it->second;
+    return it->second;
+}
+
+int Profiler::enter(const char* name) {
+    auto& buffer = _buffer();
+    auto zone = _zone(buffer, name, false);
+    buffer.stack.push_back(zone);
+    return zone;
+}
+
+void Profiler::leave(int zone, Second start) {
+    auto end = now();
+    auto& buffer = _buffer();
+    buffer.stack.pop_back();
+    std::scoped_lock lock(buffer.mutex);
+    buffer.records.push_back({zone, start, end - start});
+}
+
+void Profiler::count(const char* name, double value) {
+    auto& buffer = _buffer();
+    auto zone = _zone(buffer, name, true);
+    auto start = now();
+    std::scoped_lock lock(buffer.mutex);
+    buffer.records.push_back({zone, start, value});
+}
+
+void Profiler::collect() {
+    std::scoped_lock lock(_mutex);
+    _merge();
+    if (_capture) {
+        _writeThreadNames();
+        if (--_captureFrames == 0)
+            _stopCapture();
+    }
+}
+
+void Profiler::_merge() {
+    std::vector<Record> records;
+    for (auto& buffer : _buffers) {
+        {
+            std::scoped_lock bufferLock(buffer->mutex);
+            std::swap(records, buffer->records);
+        }
+        for (const auto& record : records) {
+            if (_capture)
+                _writeEvent(*buffer, record);
+            auto& node = _nodes[record.zone];
+            node.calls++;
+            node.total += record.value;
+            if (node.window.size() < PROFILER_WINDOW) {
+                node.window.push_back(record.value);
+            } else {
+                node.window[node.next] = record.value;
+                node.next = (node.next + 1) % PROFILER_WINDOW;
+            }
+        }
+        records.clear();
+    }
+}
+
+std::vector<Profiler::Zone> Profiler::zones() const {
+    std::scoped_lock lock(_mutex);
+    std::vector<Zone> zones;
+    zones.reserve(_nodes.size());
+    _appendZones(-1, zones);
+    return zones;
+}
+
+void Profiler::_appendZones(int parent, std::vector<Zone>& zones) const {
+    std::vector<double> sorted;
+    for (int id = 0; id < int(_nodes.size()); ++id) {
+        const auto& node = _nodes[id];
+        if (node.parent != parent)
+            continue;
+
+        Zone zone {node.name, node.depth, node.counter, node.calls, node.total};
+        if (!node.window.empty()) {
+            auto newest = node.window.size() < PROFILER_WINDOW
+                              ? node.window.size() - 1
+                              : (node.next + PROFILER_WINDOW - 1) %
+                                    PROFILER_WINDOW;
+            zone.last = node.window[newest];
+
+            sorted.assign(node.window.begin(), node.window.end());
+            auto p99 = sorted.begin() + (sorted.size() - 1) * 99 / 100;
+            std::nth_element(sorted.begin(), p99, sorted.end());
+            zone.p99 = *p99;
+            zone.min = *std::min_element(sorted.begin(), sorted.end());
+            zone.average =
+                std::accumulate(sorted.begin(), sorted.end(), 0.) /
+                double(sorted.size());
+        }
+        zones.push_back(zone);
+        _appendZones(id, zones);
+    }
+}
+
+void Profiler::reset() {
+    std::scoped_lock lock(_mutex);
+    _merge();
+    for (auto& node : _nodes) {
+        node.calls = 0;
+        node.total = 0;
+        node.window.clear();
+        node.next = 0;
+    }
+}
+
+void Profiler::setThreadName(const std::string& name) {
+    auto& buffer = _buffer();
+    std::scoped_lock lock(_mutex);
+    buffer.name = name;
+}
+
+bool Profiler::startCapture(const std::string& path, int frames) {
+    std::scoped_lock lock(_mutex);
+    _stopCapture();
+    if (frames <= 0)
+        return false;
+    _capture = std::fopen(path.c_str(), "w");
+    if (!_capture)
+        return false;
+    _captureFrames = frames;
+    _firstEvent = true;
+    _namedThreads = 0;
+    std::fputs("{\"traceEvents\":[\n", _capture);
+    return true;
+}
+
+void Profiler::stopCapture() {
+    std::scoped_lock lock(_mutex);
+    _stopCapture();
+}
+
+int Profiler::captureFrames() const {
+    std::scoped_lock lock(_mutex);
+    return _captureFrames;
+}
+
+void Profiler::_stopCapture() {
+    if (!_capture)
+        return;
+    std::fputs("\n]}\n", _capture);
+    std::fclose(_capture);
+    _capture = nullptr;
+    _captureFrames = 0;
+}
+
+void Profiler::_writeEvent(const ThreadBuffer& buffer, const Record& record) {
+    // Trace events are in microseconds
+    const auto& node = _nodes[record.zone];
+    std::fputs(_firstEvent ? "" : ",\n", _capture);
+    _firstEvent = false;
+    if (node.counter) {
+        std::fprintf(
+            _capture,
+            R"({"name":"%s","ph":"C","ts":%.3f,"pid":0,"tid":%d,)"
+            R"("args":{"value":%g}})",
+            node.name.c_str(), record.start * 1e6, buffer.id, record.value
+        );
+    } else {
+        std::fprintf(
+            _capture,
+            R"({"name":"%s","ph":"X","ts":%.3f,"dur":%.3f,"pid":0,"tid":%d})",
+            node.name.c_str(), record.start * 1e6, record.value * 1e6,
+            buffer.id
+        );
+    }
+}
+
+void Profiler::_writeThreadNames() {
+    // Names the threads that appeared since the last collect
+    for (; _namedThreads < _buffers.size(); ++_namedThreads) {
+        const auto& buffer = *_buffers[_namedThreads];
+        std::fputs(_firstEvent ? "" : ",\n", _capture);
+        _firstEvent = false;
+        std::fprintf(
+            _capture,
+            R"({"name":"thread_name","ph":"M","pid":0,"tid":%d,)"
+            R"("args":{"name":"%s"}})",
+            buffer.id, buffer.name.c_str()
+        );
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "Time.hpp"
+
+#include <cstddef>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Samples kept per zone for the rolling statistics
+constexpr std::size_t PROFILER_WINDOW = 256;
+
+// Hierarchical profiler of named zones.
+// Each thread records the zones it closes in its own buffer, and collect()
+// merges the buffers into per-zone statistics. The parent of a zone is the
+// zone that was open on the same thread when it started.
+// Use it through PROFILE_ZONE and PROFILE_COUNT, which compile to nothing
+// without PHYSIM_PROFILING.
+class Profiler {
+public:
+    struct Zone {
+        std::string name;
+        int depth;
+        bool counter; // Values given to count(), rather than durations
+        std::size_t calls = 0;
+        double total = 0;
+        double last = 0;
+        // Over the last PROFILER_WINDOW calls
+        double min = 0;
+        double average = 0;
+        double p99 = 0;
+    };
+
+    static Profiler& instance();
+    // Seconds since the profiler started, from a steady clock
+    static Second now();
+
+    // Opens a zone on the current thread, and returns its id
+    int enter(const char* name);
+    void leave(int zone, Second start);
+    // Records a value under the current zone
+    void count(const char* name, double value);
+
+    // Merges the records of every thread into the statistics
+    void collect();
+    // Statistics of every zone, each one followed by its children
+    std::vector<Zone> zones() const;
+    // Clears the statistics, but keeps the zones
+    void reset();
+
+    // Names the current thread in the captured traces
+    void setThreadName(const std::string& name);
+
+    // Streams the records of the next `frames` collects to a trace event
+    // JSON file, for chrome://tracing or Perfetto. Nothing is kept in memory
+    // besides the records of one collect.
+    // Returns false if the file can't be opened.
+    bool startCapture(const std::string& path, int frames);
+    void stopCapture();
+    // Collects left to capture, 0 when not capturing
+    int captureFrames() const;
+
+private:
+    struct Record {
+        int zone;
+        Second start;
+        double value;
+    };
+    struct ThreadBuffer {
+        int id;
+        std::string name;
+        std::mutex mutex;
+        std::vector<Record> records;
+        std::vector<int> stack;
+        std::map<std::pair<int, const char*>, int> zones;
+    };
+    struct Node {
+        std::string name;
+        int parent;
+        int depth;
+        bool counter;
+        std::size_t calls = 0;
+        double total = 0;
+        std::vector<double> window {};
+        std::size_t next = 0;
+    };
+
+    mutable std::mutex _mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> _buffers;
+    std::vector<Node> _nodes;
+    std::map<std::pair<int, std::string>, int> _nodeIds;
+
+    std::FILE* _capture = nullptr;
+    int _captureFrames = 0;
+    bool _firstEvent = true;
+    std::size_t _namedThreads = 0;
+
+    Profiler() = default;
+    ThreadBuffer& _buffer();
+    int _zone(ThreadBuffer& buffer, const char* name, bool counter);
+    void _merge();
+    void _appendZones(int parent, std::vector<Zone>& zones) const;
+    void _writeEvent(const ThreadBuffer& buffer, const Record& record);
+    void _writeThreadNames();
+    void _stopCapture();
+};
+
+// Times its own lifetime as a zone of the profiler
+class ProfileZone {
+public:
+    explicit ProfileZone(const char* name)
+        : _zone(Profiler::instance().enter(name)),
+          _start(Profiler::now()) {}
+    ~ProfileZone() { Profiler::instance().leave(_zone, _start); }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    int _zone;
+    Second _start;
+};
+
+#ifdef PHYSIM_PROFILING
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name)                                                     \
+    ProfileZone PROFILE_CONCAT(_profileZone, __LINE__)(name)
+#define PROFILE_COUNT(name, value) Profiler::instance().count(name, value)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_COUNT(name, value) ((void)0)
+#endif
@@ -0,0 +1,199 @@
+#include "Simulation.hpp"
+#include "utils/parallel.hpp"
+#include "utils/types.hpp"
+#include <algorithm>
+#include <numeric>
+#include <span>
+
+void Simulation::reset(const DrapeParameters& params) {
+    particles.clear();
+    links.clear();
+    drape(particles, links, params);
+    linkBatches = colorLinks(links, particles.size());
+    sleep.build(links, particles.size());
+    // The pinned particles first, so that the passes skip them.
+    // Everything built on the indices is built there.
+    std::vector<unsigned int> order(particles.size());
+    std::iota(order.begin(), order.end(), 0);
+    partitionPinned(order, particles.locks());
+    _applyOrder(order);
+    _stepsSinceCheck = 0;
+    _scatter = 0.f;
+}
+
+void Simulation::step(float deltaTime) {
+    PROFILE_ZONE("Step");
+    wind.update(deltaTime);
+    if (!sleep.enabled)
+        sleep.wake(particles);
+    // Gravity and wind are the same everywhere
+    auto field = translatorToVec(gravity.force) +
+                 translatorToVec(wind.calculateForce(0, {}));
+    sleep.wakeDrifted(particles, field);
+    if (useDensity)
+        sleep.wakeTouched(particles, density);
+    PROFILE_COUNT("Awake particles", double(sleep.awake()));
+    // Nothing moves until something wakes an island up
+    if (sleep.asleep())
+        return;
+    {
+        PROFILE_ZONE("Links prep");
+        _prepareLinks();
+    }
+    {
+        PROFILE_ZONE("Particles prep");
+        _prepareParticles();
+    }
+    {
+        PROFILE_ZONE("Particles update");
+        _updateParticles(deltaTime);
+    }
+    sleep.update(particles, deltaTime);
+    if (reorderInterval > 0 && ++_stepsSinceCheck >= reorderInterval) {
+        PROFILE_ZONE("Reorder");
+        _stepsSinceCheck = 0;
+        _checkOrder();
+    }
+}
+
+void Simulation::reorder() { _applyOrder(_sortedOrder()); }
+
+std::vector<unsigned int> Simulation::_sortedOrder() const {
+    auto order = mortonOrder(particles.positions(), density.gridCellSize);
+    partitionPinned(order, particles.locks());
+    return order;
+}
+
+void Simulation::_checkOrder() {
+    auto order = _sortedOrder();
+    _scatter = orderScatter(order, REORDER_NEAR);
+    PROFILE_COUNT("Order scatter %", _scatter * 100.);
+    if (_scatter > reorderThreshold) {
+        _applyOrder(order);
+        PROFILE_COUNT("Reorders", double(_reorders));
+    }
+}
+
+void Simulation::_applyOrder(std::span<const unsigned int> order) {
+    particles.permute(order);
+    sleep.permute(order);
+    _remap.resize(order.size());
+    for (std::size_t k = 0; k < order.size(); ++k) {
+        _remap[order[k]] = k;
+    }
+
+    // The colors only depend on which links share a particle, so the
+    // batches stay valid. Each batch is walked in the new particle order.
+    for (auto& link : links) {
+        link.a = _remap[link.a];
+        link.b = _remap[link.b];
+    }
+    for (std::size_t b = 0; b + 1 < linkBatches.size(); ++b) {
+        std::ranges::sort(
+            links.begin() + linkBatches[b], links.begin() + linkBatches[b + 1],
+            {}, [](const SpringLink& link) { return std::min(link.a, link.b); }
+        );
+    }
+    adjacency.build(
+        links, particles.size(), spring.stiffness, spring.viscosity
+    );
+    density.setParticles(particles);
+    ++_reorders;
+}
+
+void Simulation::_prepareLinks() {
+    switch (solverMode) {
+    case SolverMode::Explicit: break;
+    case SolverMode::Implicit:
+        // The springs are part of the solve, the other forces feed it
+        implicitSolver.assemble(particles, adjacency);
+        return;
+    case SolverMode::Position:
+        // The other forces predict the positions, the springs correct them
+        positionSolver.begin(particles);
+        return;
+    }
+
+    auto locks = particles.locks();
+    switch (springMode) {
+    case SpringMode::ColorBatches:
+        // One batch of independent links at a time, but those between two
+        // held particles
+        for (std::size_t b = 0; b + 1 < linkBatches.size(); ++b) {
+            auto first = linkBatches[b];
+            parallelFor(linkBatches[b + 1] - first, [&](std::size_t k) {
+                const auto& link = links[first + k];
+                if (locks[link.a] && locks[link.b])
+                    return;
+                spring.prepareForce(
+                    particles[link.a], particles[link.b], link.length
+                );
+            });
+        }
+        break;
+    case SpringMode::Gather: adjacency.prepareForces(particles); break;
+    case SpringMode::SimdBatches:
+        for (std::size_t b = 0; b + 1 < linkBatches.size(); ++b) {
+            prepareSpringBatch(
+                particles,
+                std::span(links).subspan(
+                    linkBatches[b], linkBatches[b + 1] - linkBatches[b]
+                ),
+                spring.stiffness, spring.viscosity
+            );
+        }
+        break;
+    }
+}
+
+template <typename Func>
+void Simulation::_withForces(Func&& func) const {
+    if (useDensity)
+        func(ForceSet(gravity, ground, wind, density));
+    else
+        func(ForceSet(gravity, ground, wind));
+}
+
+void Simulation::_prepareParticles() {
+    if (useDensity)
+        density.prepareForces();
+    // The implicit solve needs every force before moving anything
+    if (solverMode == SolverMode::Implicit) {
+        _withForces([&](const auto& forces) {
+            particles.prepareForces(forces);
+        });
+    }
+}
+
+void Simulation::_updateParticles(float deltaTime) {
+    // Outside of the implicit solve, the particle forces are accumulated in
+    // the same sweep as the integration
+    const auto integrate = [&](const auto& forces) {
+        particles.integrate(deltaTime, forces);
+    };
+    switch (solverMode) {
+    case SolverMode::Explicit: _withForces(integrate); break;
+    case SolverMode::Implicit:
+        {
+            PROFILE_ZONE("CG solve");
+            implicitSolver.solve(particles, adjacency, deltaTime);
+        }
+        PROFILE_COUNT("CG iterations", implicitSolver.iterations());
+        particles.integrate(deltaTime);
+        break;
+    case SolverMode::Position:
+        _withForces(integrate);
+        {
+            PROFILE_ZONE("Constraints");
+            positionSolver.solve(
+                particles, links, linkBatches, adjacency, spring.stiffness,
+                deltaTime
+            );
+        }
+        break;
+    }
+    if (useDensity) {
+        PROFILE_ZONE("Density update");
+        density.update();
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "ParticleSystem.hpp"
+#include "Profiler.hpp"
+#include "constants.hpp"
+#include "density.hpp"
+#include "forces.hpp"
+#include "implicit.hpp"
+#include "links.hpp"
+#include "reorder.hpp"
+#include "sleep.hpp"
+#include "springs.hpp"
+#include "xpbd.hpp"
+#include "utils/creators.hpp"
+
+#include <klein/klein.hpp>
+#include <span>
+#include <string>
+#include <vector>
+
+enum class SolverMode {
+    Explicit, // Springs as forces, integrated by semi-implicit Euler
+    Implicit, // Springs integrated by backward Euler
+    Position, // Springs as distance constraints, projected after integration
+};
+
+// The whole physics state of a drape, and the passes that advance it.
+// It does not depend on any window, so it can run headless.
+class Simulation {
+public:
+    ParticleSystem particles;
+    std::vector<SpringLink> links;
+    std::vector<std::size_t> linkBatches;
+    SpringAdjacency adjacency;
+    SpringMode springMode = SpringMode::ColorBatches;
+    SolverMode solverMode = SolverMode::Explicit;
+    ImplicitSolver implicitSolver;
+    PositionSolver positionSolver;
+    SleepTracker sleep;
+    bool useDensity = true;
+    // Steps between two checks of the particle order, 0 to keep it
+    int reorderInterval = REORDER_INTERVAL;
+    float reorderThreshold = REORDER_THRESHOLD;
+
+    Wall ground {GROUND, GROUND_FORCE};
+    ConstantForce gravity {kln::translator(GRAVITY, 0, -1, 0)};
+    Spring spring {KNOT, STIFF, VISCOSITY};
+    Density density {
+        DENSITY_REPULSION, DENSITY_LOOKUP_RADIUS, DENSITY_GRID_SIZE,
+        Density::Backend::SortedGrid, DENSITY_SKIN,
+    };
+    Wind wind {
+        WIND_FREQ,
+        WIND_AMP,
+    };
+
+    // Replaces the particles and links by a new drape
+    void reset(const DrapeParameters& params);
+
+    // Advances the simulation by deltaTime, in the "Step" profiler zone
+    void step(float deltaTime);
+
+    // Sorts the particles along the Z-order curve of their cells, so that
+    // the neighbors in space are mostly neighbors in memory. The pinned ones
+    // stay in front, out of the dynamic range of ParticleSystem.
+    // The links, and everything built on the indices, follow.
+    void reorder();
+    // Number of reorders so far, to notice them from outside
+    std::size_t reorders() const { return _reorders; }
+    // New index of each particle index before the last reorder, or of each
+    // index given by drape() after a reset
+    std::span<const unsigned int> remap() const { return _remap; }
+    // Last measure of orderScatter(), the cache miss proxy
+    float scatter() const { return _scatter; }
+
+private:
+    void _prepareLinks();
+    void _prepareParticles();
+    void _updateParticles(float deltaTime);
+    std::vector<unsigned int> _sortedOrder() const;
+    void _checkOrder();
+    void _applyOrder(std::span<const unsigned int> order);
+
+    // Calls func with the ForceSet of the enabled particle forces
+    template <typename Func>
+    void _withForces(Func&& func) const;
+
+    int _stepsSinceCheck = 0;
+    std::size_t _reorders = 0;
+    float _scatter = 0.f;
+    std::vector<unsigned int> _remap;
+};
+
+inline std::string to_string(SolverMode mode) {
+    switch (mode) {
+    case SolverMode::Explicit: return "Explicit";
+    case SolverMode::Implicit: return "Implicit";
+    case SolverMode::Position: return "XPBD";
+    }
+    return "Unknown";
+}
+const auto solver_modes = {
+    SolverMode::Explicit,
+    SolverMode::Implicit,
+    SolverMode::Position,
+};
@@ -1,16 +1,20 @@
 #include "Time.hpp"
-#include <utility>
+#include <chrono>
 
-#include <glfwpp/glfwpp.h>
+static Second now() {
+    using Clock = std::chrono::steady_clock;
+    return std::chrono::duration<Second>(Clock::now().time_since_epoch())
+        .count();
+}
 
 Time::Time() {
-    _startTime = glfw::getTime();
+    _startTime = now();
     _lastTime = _startTime;
     _deltaTime = 0.0;
 }
 
 void Time::tick() {
-    auto currentTime = glfw::getTime();
+    auto currentTime = now();
     _deltaTime = currentTime - _lastTime;
     _lastTime = currentTime;
     _elapsedTime = currentTime - _startTime;
@@ -24,23 +28,37 @@ Second Time::elapsedTime() const {
     return _elapsedTime;
 }
 
-Profiler::Profiler() {
-    _times.reserve(1000);
-    begin();
-}
+StepScheduler::StepScheduler(Second fixedDeltaTime, int maxSubsteps)
+    : fixedDeltaTime(fixedDeltaTime),
+      maxSubsteps(maxSubsteps),
+      _deltaTime(fixedDeltaTime) {}
+
+int StepScheduler::advance(Second elapsed) {
+    _deltaTime = fixedDeltaTime;
+    int maxSteps = maxSubsteps;
+    _accumulator += elapsed;
+    int steps = static_cast<int>(_accumulator / _deltaTime);
+    if (steps > maxSteps) {
+        steps = maxSteps;
+        _accumulator = _deltaTime * steps;
+    }
+    _accumulator -= _deltaTime * steps;
 
-void Profiler::begin() {
-    _times.clear();
-    _times.push_back(glfw::getTime());
+    // Throughput over a rolling one second window
+    _window += elapsed;
+    _windowSteps += steps;
+    if (_window >= 1.0) {
+        _stepsPerSecond = _windowSteps / _window;
+        _window = 0;
+        _windowSteps = 0;
+    }
+    return steps;
 }
 
-void Profiler::tick() {
-    _times.push_back(glfw::getTime());
+Second StepScheduler::remaining() const {
+    return _deltaTime - _accumulator;
 }
 
-Second Profiler::operator[](size_t index) const {
-    if (index > _times.size()) {
-        return 0.0;
-    }
-    return _times[index + 1] - _times[index];
+float StepScheduler::alpha() const {
+    return static_cast<float>(_accumulator / _deltaTime);
 }
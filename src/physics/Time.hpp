@@ -1,6 +1,7 @@
 #pragma once
 
-#include <vector>
+#include <atomic>
+#include <cstddef>
 using Second = double;
 
 class Time {
@@ -19,15 +20,34 @@ private:
     Second _elapsedTime;
 };
 
-class Profiler {
+// Turns the wall-clock time into a whole number of fixed steps.
+// The time that does not fill a whole step is kept for the next call.
+class StepScheduler {
 public:
-    Profiler();
-
-    void begin();
-    void tick();
-
-    Second operator[](size_t index) const;
+    StepScheduler(Second fixedDeltaTime, int maxSubsteps);
+
+    // Settings, which another thread may change at any time. Each advance()
+    // reads them once, and the other calls stick to what it read.
+    std::atomic<Second> fixedDeltaTime;
+    // Steps beyond this are dropped, so that a slow step can't snowball
+    std::atomic<int> maxSubsteps;
+
+    // Adds the elapsed time, and returns the number of steps to run now
+    int advance(Second elapsed);
+    // Time step of the steps returned by the last advance()
+    Second deltaTime() const { return _deltaTime; }
+    // Time left until the next step is due
+    Second remaining() const;
+    // How far the accumulator is between the last step and the next one,
+    // to interpolate the rendered state
+    float alpha() const;
+    // Safe to read from any thread
+    double stepsPerSecond() const { return _stepsPerSecond; }
 
 private:
-    std::vector<Second> _times;
+    Second _deltaTime;
+    Second _accumulator = 0;
+    Second _window = 0;
+    int _windowSteps = 0;
+    std::atomic<double> _stepsPerSecond = 0;
 };
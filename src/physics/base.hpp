@@ -1,22 +1,31 @@
 #pragma once
 
-#include "../utils/events.hpp"
 #include "Time.hpp"
+#include "compact.hpp"
 
+#include <cstdint>
 #include <klein/klein.hpp>
 
-class Particle {
-public:
-    kln::point position;
-    float mass;
-
-    kln::translator velocity {};
-    kln::translator force {};
-    bool lock {false};
+// Storage of the particle velocities and forces
+#ifdef PHYSIM_COMPACT_PARTICLES
+using Motion = CompactTranslator;
+#else
+using Motion = kln::translator;
+#endif
 
-    Event<void(kln::point oldPos, kln::point newPos)> onMove {};
+// Bits of Particle::lock. Any of them holds the particle in place.
+constexpr std::uint8_t LOCK_PINNED = 1; // Anchor of the drape
+constexpr std::uint8_t LOCK_ASLEEP = 2; // At rest, see SleepTracker
 
-    Particle(const kln::point& position = {}, float mass = 1.f);
+// View over one particle of a ParticleSystem.
+// It is cheap to copy, and every copy refers to the same particle.
+class Particle {
+public:
+    kln::point& position;
+    Motion& velocity;
+    Motion& force;
+    float& inverseMass;
+    std::uint8_t& lock;
 
     void update(const Second& deltaTime);
     void applyForce(const kln::translator& _force, const Second& deltaTime);
@@ -26,11 +35,11 @@ public:
 
 class Link {
 public:
-    virtual void applyForce(const Second& deltaTime, Particle& p1) = 0;
+    virtual void applyForce(const Second& deltaTime, Particle p1) = 0;
     virtual void applyForce(
-        const Second& deltaTime, Particle& p1, Particle& p2
+        const Second& deltaTime, Particle p1, Particle p2
     ) = 0;
 
-    virtual void prepareForce(Particle& p1) = 0;
-    virtual void prepareForce(Particle& p1, Particle& p2) = 0;
+    virtual void prepareForce(Particle p1) = 0;
+    virtual void prepareForce(Particle p1, Particle p2) = 0;
 };
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <klein/klein.hpp>
+
+// Translator stored as its e01, e02 and e03 components only, in 12 bytes
+// instead of a whole SSE register. The particles only ever hold pure
+// translations, whose e0123 component is always 0.
+// It converts from and to kln::translator at the PGA boundary, and keeps
+// the few operators the particle passes use, with the same results.
+class CompactTranslator {
+public:
+    CompactTranslator() = default;
+    CompactTranslator(const kln::translator& t) {
+        alignas(16) float components[4];
+        _mm_store_ps(components, t.p2_);
+        _e01 = components[1];
+        _e02 = components[2];
+        _e03 = components[3];
+    }
+
+    operator kln::translator() const {
+        kln::translator t;
+        t.p2_ = _mm_set_ps(_e03, _e02, _e01, 0.f);
+        return t;
+    }
+
+    float e01() const { return _e01; }
+    float e02() const { return _e02; }
+    float e03() const { return _e03; }
+
+    CompactTranslator& operator+=(const CompactTranslator& other) {
+        _e01 += other._e01;
+        _e02 += other._e02;
+        _e03 += other._e03;
+        return *this;
+    }
+    CompactTranslator& operator-=(const CompactTranslator& other) {
+        _e01 -= other._e01;
+        _e02 -= other._e02;
+        _e03 -= other._e03;
+        return *this;
+    }
+    CompactTranslator& operator*=(float s) {
+        _e01 *= s;
+        _e02 *= s;
+        _e03 *= s;
+        return *this;
+    }
+
+    // Applies the translation to p
+    kln::point operator()(const kln::point& p) const {
+        return kln::translator(*this)(p);
+    }
+
+    friend CompactTranslator operator+(
+        CompactTranslator a, const CompactTranslator& b
+    ) {
+        return a += b;
+    }
+    friend CompactTranslator operator-(
+        CompactTranslator a, const CompactTranslator& b
+    ) {
+        return a -= b;
+    }
+    friend CompactTranslator operator*(CompactTranslator a, float s) {
+        return a *= s;
+    }
+    friend CompactTranslator operator*(float s, CompactTranslator a) {
+        return a *= s;
+    }
+
+private:
+    float _e01 = 0.f;
+    float _e02 = 0.f;
+    float _e03 = 0.f;
+};
+static_assert(sizeof(CompactTranslator) == 3 * sizeof(float));
@@ -1,105 +1,983 @@
 #include "density.hpp"
+#include "Profiler.hpp"
 #include "base.hpp"
+#include "reorder.hpp"
 #include "glm/common.hpp"
 #include "klein/point.hpp"
 #include "klein/translator.hpp"
 #include "utils/math.hpp"
+#include "utils/parallel.hpp"
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <numeric>
 
-void Density::setParticles(std::vector<Particle>& particles) {
+// Bounds the size of the sorted grid. When the particles spread further than
+// that, the flat hash replaces it until they gather again.
+constexpr std::size_t MIN_GRID_CELLS = 1 << 15;
+constexpr std::size_t GRID_CELLS_PER_PARTICLE = 8;
+// The flat hash is kept at most half full
+constexpr std::size_t HASH_SLOTS_PER_PARTICLE = 2;
+// Pairs visited by each chunk of prepareForces(). The chunks don't depend on
+// the thread count, so neither do the sums of the forces.
+constexpr std::size_t PAIR_CHUNK = 512;
+
+// Row of cells along x, packed on 31 bits for each of y and z. The rows
+// further than 2^30 from the origin wrap around onto others, which only
+// adds candidates that the distance checks then reject.
+static std::uint64_t packRow(const glm::ivec3& c) {
+    constexpr std::uint64_t bias = 1 << 30;
+    constexpr std::uint64_t mask = (1u << 31) - 1;
+    return ((std::uint64_t(c.y) + bias) & mask) |
+           ((std::uint64_t(c.z) + bias) & mask) << 31;
+}
+
+// Finalizer of MurmurHash3, so that the neighbor rows spread over the
+// whole table
+static std::uint64_t mixHash(std::uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccd;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53;
+    key ^= key >> 33;
+    return key;
+}
+
+void Density::setParticles(ParticleSystem& particles) {
+    _particles = &particles;
     _particleMap.clear();
-    _particleMap.reserve(particles.size());
-    for (auto& p : particles) {
-        _particleMap.emplace(_cell(p), &p);
-        p.onMove += [&](const kln::point& oldPos, const kln::point& newPos) {
-            auto oldHash = _cell(oldPos);
-            auto newHash = _cell(newPos);
-
-            if (oldHash != newHash) {
-                auto range = _particleMap.equal_range(oldHash);
-                for (auto it = range.first; it != range.second; ++it) {
-                    if (it->second == &p) {
-                        _particleMap.erase(it);
-                        break;
+    _rebuild();
+    _listRadius = 0.f;
+    _pairForces.clear();
+    _updateLists();
+}
+
+void Density::setBackend(Backend backend) {
+    if (backend == _backend)
+        return;
+    _backend = backend;
+    _rebuild();
+}
+
+void Density::_rebuild() {
+    _particleMap.clear();
+    _structure = _backend;
+    switch (_backend) {
+    case Backend::HashMap: _fillMap(); break;
+    case Backend::SortedGrid: _rebuildGrid(); break;
+    case Backend::FlatHash: _rebuildHash(); break;
+    }
+}
+
+void Density::update() {
+    switch (_backend) {
+    case Backend::HashMap: _updateMap(); break;
+    case Backend::SortedGrid: _rebuildGrid(); break;
+    case Backend::FlatHash: _rebuildHash(); break;
+    }
+    _updateLists();
+    PROFILE_COUNT("Density memory KB", double(memoryUsage()) / 1024.);
+}
+
+void Density::_fillMap() {
+    if (!_particles)
+        return;
+    auto positions = _particles->positions();
+    _mapCells.resize(positions.size());
+    _positions.assign(positions.begin(), positions.end());
+    _particleMap.reserve(positions.size());
+    for (uint i = 0; i < positions.size(); ++i) {
+        _mapCells[i] = _cell(positions[i]);
+        _particleMap.emplace(_mapCells[i], i);
+    }
+    _updateOccupied();
+}
+
+void Density::_updateOccupied() {
+    if (_mapCells.empty()) {
+        _occupiedMin = {};
+        _occupiedMax = glm::ivec3(-1);
+        return;
+    }
+    _occupiedMin = _occupiedMax = _mapCells.front();
+    for (const auto& c : _mapCells) {
+        _occupiedMin = glm::min(_occupiedMin, c);
+        _occupiedMax = glm::max(_occupiedMax, c);
+    }
+}
+
+void Density::_updateMap() {
+    if (!_particles)
+        return;
+    PROFILE_ZONE("Map update");
+    auto positions = _particles->positions();
+    _newCells.resize(positions.size());
+    _positions.resize(positions.size());
+    parallelFor(positions.size(), [&](std::size_t i) {
+        _newCells[i] = _cell(positions[i]);
+        _positions[i] = positions[i];
+    });
+
+    // Only the particles that changed cell touch the map
+    for (uint i = 0; i < positions.size(); ++i) {
+        auto oldCell = _mapCells[i];
+        auto newCell = _newCells[i];
+        if (oldCell == newCell)
+            continue;
+
+        auto range = _particleMap.equal_range(oldCell);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == i) {
+                _particleMap.erase(it);
+                break;
+            }
+        }
+        _particleMap.emplace(newCell, i);
+    }
+    std::swap(_mapCells, _newCells);
+    _updateOccupied();
+}
+
+void Density::_rebuildGrid() {
+    if (!_particles)
+        return;
+    PROFILE_ZONE("Grid rebuild");
+    auto positions = _particles->positions();
+
+    _sortedIndices.resize(positions.size());
+    _sortedPositions.resize(positions.size());
+    _particleCells.resize(positions.size());
+    _positions.resize(positions.size());
+    if (positions.empty()) {
+        _gridDims = {};
+        _cellStart.assign(1, 0);
+        return;
+    }
+
+    // Bounds of the occupied cells
+    glm::ivec3 min = _cell(positions.front());
+    glm::ivec3 max = min;
+    for (const auto& p : positions) {
+        auto c = _cell(p);
+        min = glm::min(min, c);
+        max = glm::max(max, c);
+    }
+    // Too spread out for a grid that fits in memory. Clamping the outer
+    // particles onto its border would pile them up in a few cells, so the
+    // flat hash, which only stores the occupied rows, takes over.
+    auto dims = max - min + glm::ivec3(1);
+    auto maxCells = std::max(
+        MIN_GRID_CELLS, positions.size() * GRID_CELLS_PER_PARTICLE
+    );
+    if (std::size_t(dims.x) * dims.y * dims.z > maxCells) {
+        _rebuildHash();
+        return;
+    }
+    _structure = Backend::SortedGrid;
+    _gridMin = min;
+    _occupiedMin = min;
+    _occupiedMax = max;
+    _gridDims = max - min + glm::ivec3(1);
+    const auto cellCount = [&] {
+        return std::size_t(_gridDims.x) * _gridDims.y * _gridDims.z;
+    };
+
+    parallelFor(positions.size(), [&](std::size_t i) {
+        _particleCells[i] = _gridIndex(_clampToGrid(_cell(positions[i])));
+        _positions[i] = positions[i];
+    });
+
+    // Counting sort of the particles by cell
+    _cellStart.assign(cellCount() + 1, 0);
+    for (auto c : _particleCells) {
+        ++_cellStart[c + 1];
+    }
+    std::inclusive_scan(
+        _cellStart.begin(), _cellStart.end(), _cellStart.begin()
+    );
+
+    _cellCursor.assign(_cellStart.begin(), _cellStart.end() - 1);
+    for (uint i = 0; i < positions.size(); ++i) {
+        auto slot = _cellCursor[_particleCells[i]]++;
+        _sortedIndices[slot] = i;
+        _sortedPositions[slot] = positions[i];
+    }
+}
+
+void Density::_rebuildHash() {
+    if (!_particles)
+        return;
+    PROFILE_ZONE("Hash rebuild");
+    _structure = Backend::FlatHash;
+    auto positions = _particles->positions();
+    auto count = positions.size();
+
+    _sortedIndices.resize(count);
+    _sortedPositions.resize(count);
+    _sortedX.resize(count);
+    _particleSlots.resize(count);
+    _positions.resize(count);
+    _newCells.resize(count);
+    parallelFor(count, [&](std::size_t i) {
+        _newCells[i] = _cell(positions[i]);
+        _positions[i] = positions[i];
+    });
+
+    std::size_t capacity = 16;
+    while (capacity < count * HASH_SLOTS_PER_PARTICLE) {
+        capacity *= 2;
+    }
+    _hashSlots.assign(capacity, {});
+    auto mask = capacity - 1;
+
+    // Counts the particles of each row, in the slot of the row
+    if (count > 0)
+        _occupiedMin = _occupiedMax = _newCells.front();
+    for (uint i = 0; i < count; ++i) {
+        const auto& cell = _newCells[i];
+        auto key = packRow(cell);
+        auto s = mixHash(key) & mask;
+        while (_hashSlots[s].key != key && _hashSlots[s].key != EMPTY_ROW) {
+            s = (s + 1) & mask;
+        }
+        _hashSlots[s].key = key;
+        ++_hashSlots[s].count;
+        _particleSlots[i] = uint(s);
+        _occupiedMin = glm::min(_occupiedMin, cell);
+        _occupiedMax = glm::max(_occupiedMax, cell);
+    }
+
+    // Counting sort of the particles, with the rows by increasing key, so
+    // by z then y: as in the sorted grid, the rows of the half shell of a
+    // row come after it
+    _hashRows.clear();
+    for (uint s = 0; s < capacity; ++s) {
+        if (_hashSlots[s].count > 0)
+            _hashRows.push_back(s);
+    }
+    std::sort(_hashRows.begin(), _hashRows.end(), [&](uint a, uint b) {
+        return _hashSlots[a].key < _hashSlots[b].key;
+    });
+    _cellCursor.resize(capacity);
+    uint first = 0;
+    for (auto s : _hashRows) {
+        _hashSlots[s].first = first;
+        _cellCursor[s] = first;
+        first += _hashSlots[s].count;
+    }
+    for (uint i = 0; i < count; ++i) {
+        _sortedIndices[_cellCursor[_particleSlots[i]]++] = i;
+    }
+
+    // Then each row by increasing x, so that the cells of a range of x are
+    // contiguous
+    parallelFor(capacity, [&](std::size_t s) {
+        const auto& slot = _hashSlots[s];
+        auto begin = _sortedIndices.begin() + slot.first;
+        std::sort(begin, begin + slot.count, [&](uint a, uint b) {
+            return std::pair(_newCells[a].x, a) < std::pair(_newCells[b].x, b);
+        });
+    });
+    parallelFor(count, [&](std::size_t t) {
+        auto i = _sortedIndices[t];
+        _sortedPositions[t] = positions[i];
+        _sortedX[t] = _newCells[i].x;
+    });
+}
+
+std::size_t Density::memoryUsage() const {
+    const auto bytes = [](const auto& v) {
+        return v.capacity() * sizeof(v[0]);
+    };
+    switch (_structure) {
+    case Backend::HashMap: {
+        // Each node holds its value, the next node and the cached hash
+        auto node = sizeof(decltype(_particleMap)::value_type) +
+                    2 * sizeof(void*);
+        return _particleMap.size() * node +
+               _particleMap.bucket_count() * sizeof(void*) +
+               bytes(_mapCells) + bytes(_newCells);
+    }
+    case Backend::SortedGrid:
+        return bytes(_cellStart) + bytes(_cellCursor) +
+               bytes(_sortedIndices) + bytes(_sortedPositions) +
+               bytes(_particleCells);
+    case Backend::FlatHash:
+        return bytes(_hashSlots) + bytes(_hashRows) + bytes(_cellCursor) +
+               bytes(_sortedIndices) + bytes(_sortedPositions) +
+               bytes(_sortedX) + bytes(_particleSlots) + bytes(_newCells);
+    }
+    return 0;
+}
+
+void Density::_updateLists() {
+    if (skin <= 0 || !_particles) {
+        _listRadius = 0.f;
+        return;
+    }
+    auto radius = lookupRadius + skin;
+    auto count = _positions.size();
+    auto outdated = radius != _listRadius || pairwise != _listsPairwise ||
+                    _listPositions.size() != count;
+    if (!outdated) {
+        // No pair can have come within lookupRadius without one of its
+        // particles moving by more than half the skin
+        auto limit = skin / 2;
+        auto moved = parallelSum(count, std::size_t(0), [&](std::size_t i) {
+            auto distance = (_positions[i] & _listPositions[i]).norm();
+            return std::size_t(distance > limit);
+        });
+        outdated = moved > 0;
+    }
+    if (outdated)
+        _buildLists(radius);
+    PROFILE_COUNT("Neighbor rebuilds", double(_rebuilds));
+}
+
+void Density::_buildLists(float radius) {
+    PROFILE_ZONE("Neighbor lists");
+    auto count = _positions.size();
+    // In pairwise mode, each pair is only listed from its first particle
+    const auto listed = [&](std::size_t i, uint j) {
+        return pairwise ? j > i : j != i;
+    };
+    const auto forEachNeighbor = [&](std::size_t i, auto&& func) {
+        const auto& p1 = _positions[i];
+        _forEachNearby(p1, radius, [&](uint j, const kln::point& p2) {
+            if (listed(i, j) && (p1 & p2).norm() <= radius)
+                func(j);
+        });
+    };
+
+    // Each chunk gathers its own lists, which are then copied in place
+    std::mutex mutex;
+    std::vector<std::pair<std::size_t, std::vector<uint>>> chunks;
+    _neighborStart.assign(count + 1, 0);
+    parallelChunks("Lists chunk", count, [&](auto begin, auto end) {
+        std::vector<uint> neighbors;
+        for (auto i = begin; i < end; ++i) {
+            auto first = neighbors.size();
+            forEachNeighbor(i, [&](uint j) { neighbors.push_back(j); });
+            _neighborStart[i + 1] = neighbors.size() - first;
+        }
+        std::scoped_lock lock(mutex);
+        chunks.emplace_back(begin, std::move(neighbors));
+    });
+    std::inclusive_scan(
+        _neighborStart.begin(), _neighborStart.end(), _neighborStart.begin()
+    );
+    _neighbors.resize(_neighborStart.back());
+    parallelFor(
+        chunks.size(),
+        [&](std::size_t c) {
+            const auto& [begin, neighbors] = chunks[c];
+            auto out = _neighbors.begin() + _neighborStart[begin];
+            std::ranges::copy(neighbors, out);
+        },
+        1
+    );
+
+    _listPositions = _positions;
+    _listRadius = radius;
+    _listsPairwise = pairwise;
+    ++_rebuilds;
+}
+
+bool Density::_hasLists() const {
+    return _listRadius > 0 && _listRadius == lookupRadius + skin &&
+           _listsPairwise == pairwise;
+}
+
+void Density::prepareForces() {
+    if (!pairwise || !_particles) {
+        _pairForces.clear();
+        return;
+    }
+    PROFILE_ZONE("Density pairs");
+    auto count = _positions.size();
+    auto chunks = (count + PAIR_CHUNK - 1) / PAIR_CHUNK;
+    if (_chunkForces.size() < chunks)
+        _chunkForces.resize(chunks);
+    auto bySlot = !_hasLists() && _structure != Backend::HashMap;
+    const auto particle = [&](uint key) {
+        return bySlot ? _sortedIndices[key] : key;
+    };
+
+    // The chunk c adds the forces of the keys from c * PAIR_CHUNK up to the
+    // last one its pairs reach, into its own buffer
+    auto locks = _particles->locks();
+    parallelChunks(
+        "Pairs chunk", chunks,
+        [&](std::size_t first, std::size_t last) {
+            for (auto c = first; c < last; ++c) {
+                auto begin = c * PAIR_CHUNK;
+                auto end = std::min(count, begin + PAIR_CHUNK);
+                auto& forces = _chunkForces[c];
+                forces.assign(end - begin, {});
+                _forEachPair(
+                    begin, end,
+                    [&](uint a, uint b, const kln::point& pa,
+                        const kln::point& pb) {
+                        // Nothing moves two held particles apart
+                        if (locks[particle(a)] && locks[particle(b)])
+                            return;
+                        auto force = _repulsion(pa, pb);
+                        if (b - begin >= forces.size())
+                            forces.resize(b - begin + 1);
+                        forces[a - begin] += force;
+                        forces[b - begin] += force * -1.f;
                     }
-                }
-                _particleMap.emplace(newHash, &p);
+                );
+            }
+        },
+        1
+    );
+
+    // First chunk whose buffer reaches each chunk of keys
+    _firstChunks.resize(chunks);
+    for (std::size_t c = 0; c < chunks; ++c) {
+        _firstChunks[c] = c;
+    }
+    for (std::size_t c = 0; c < chunks; ++c) {
+        auto reach = (c * PAIR_CHUNK + _chunkForces[c].size() - 1) / PAIR_CHUNK;
+        for (auto d = c + 1; d <= reach; ++d) {
+            _firstChunks[d] = std::min(_firstChunks[d], c);
+        }
+    }
+
+    // Summed in the order of the chunks, whichever thread ran them
+    _pairForces.resize(count);
+    parallelFor(count, [&](std::size_t k) {
+        auto chunk = k / PAIR_CHUNK;
+        kln::translator force = {};
+        for (auto c = _firstChunks[chunk]; c <= chunk; ++c) {
+            auto offset = k - c * PAIR_CHUNK;
+            if (offset < _chunkForces[c].size())
+                force += _chunkForces[c][offset];
+        }
+        _pairForces[particle(uint(k))] = force;
+    });
+}
+
+template <typename Func>
+void Density::_forEachPair(
+    std::size_t begin, std::size_t end, Func&& func
+) const {
+    if (_hasLists()) {
+        for (auto i = begin; i < end; ++i) {
+            auto last = _neighborStart[i + 1];
+            for (auto e = _neighborStart[i]; e < last; ++e) {
+                auto j = _neighbors[e];
+                func(i, j, _positions[i], _positions[j]);
             }
+        }
+        return;
+    }
+
+    if (_structure == Backend::FlatHash) {
+        // Half shell stencil, as for the sorted grid. The rows around a row
+        // are found once for all of its particles, which then slide a window
+        // of cells along each of them, by increasing x.
+        auto halfSize =
+            static_cast<int>(std::ceil(lookupRadius / gridCellSize));
+        struct Window {
+            uint lo, hi, last;
         };
+        std::vector<Window> windows;
+        auto row = ~uint(0);
+        for (auto s = uint(begin); s < end; ++s) {
+            auto i = _sortedIndices[s];
+            const auto& pi = _sortedPositions[s];
+            auto x = _sortedX[s];
+            if (_particleSlots[i] != row) {
+                row = _particleSlots[i];
+                const auto& own = _hashSlots[row];
+                windows.assign(1, {s + 1, s + 1, own.first + own.count});
+                auto c = _newCells[i];
+                const auto addRow = [&](int dy, int dz) {
+                    // Past the wrap around of the keys, a row of the half
+                    // shell may come first, and its pairs are dropped
+                    auto slot = _findSlot(c + glm::ivec3(0, dy, dz));
+                    if (slot && slot->first > s) {
+                        auto first = slot->first;
+                        windows.push_back({first, first, first + slot->count});
+                    }
+                };
+                for (int dy = 1; dy <= halfSize; ++dy) {
+                    addRow(dy, 0);
+                }
+                for (int dz = 1; dz <= halfSize; ++dz) {
+                    for (int dy = -halfSize; dy <= halfSize; ++dy) {
+                        addRow(dy, dz);
+                    }
+                }
+            }
+            // In its own row, only the later particles
+            windows.front().lo = s + 1;
+            for (auto& window : windows) {
+                auto& [lo, hi, last] = window;
+                while (lo < last && _sortedX[lo] < x - halfSize) {
+                    ++lo;
+                }
+                hi = std::max(hi, lo);
+                while (hi < last && _sortedX[hi] <= x + halfSize) {
+                    ++hi;
+                }
+                for (auto t = lo; t < hi; ++t) {
+                    func(s, t, pi, _sortedPositions[t]);
+                }
+            }
+        }
+        return;
+    }
+
+    if (_structure == Backend::HashMap) {
+        for (auto i = begin; i < end; ++i) {
+            const auto& pi = _positions[i];
+            _forEachInMap(
+                pi, lookupRadius,
+                [&](uint j, const kln::point& pj) {
+                    if (j > i)
+                        func(i, j, pi, pj);
+                }
+            );
+        }
+        return;
+    }
+
+    // Half shell stencil: the later particles of the same cell, then the
+    // cells that come after it in the grid order
+    auto halfSize = static_cast<int>(std::ceil(lookupRadius / gridCellSize));
+    const auto forSlots = [&](uint s, uint first, uint last) {
+        const auto& pi = _sortedPositions[s];
+        for (auto t = first; t < last; ++t) {
+            func(s, t, pi, _sortedPositions[t]);
+        }
+    };
+    const auto forRow = [&](uint s, glm::ivec3 c, int dy, int dz, int dx0) {
+        auto y = c.y + dy;
+        auto z = c.z + dz;
+        if (y < 0 || y >= _gridDims.y || z < 0 || z >= _gridDims.z)
+            return;
+        auto lo = std::max(c.x + dx0, 0);
+        auto hi = std::min(c.x + halfSize, _gridDims.x - 1);
+        if (lo > hi)
+            return;
+        auto row = _gridMin + glm::ivec3(0, y, z);
+        auto first = _cellStart[_gridIndex(row + glm::ivec3(lo, 0, 0))];
+        auto last = _cellStart[_gridIndex(row + glm::ivec3(hi, 0, 0)) + 1];
+        forSlots(s, first, last);
+    };
+    for (auto s = uint(begin); s < end; ++s) {
+        auto cell = _particleCells[_sortedIndices[s]];
+        auto c = glm::ivec3(
+            cell % _gridDims.x, cell / _gridDims.x % _gridDims.y,
+            cell / (_gridDims.x * _gridDims.y)
+        );
+        forSlots(s, s + 1, _cellStart[cell + 1]);
+        forRow(s, c, 0, 0, 1);
+        for (int dy = 1; dy <= halfSize; ++dy) {
+            forRow(s, c, dy, 0, -halfSize);
+        }
+        for (int dz = 1; dz <= halfSize; ++dz) {
+            for (int dy = -halfSize; dy <= halfSize; ++dy) {
+                forRow(s, c, dy, dz, -halfSize);
+            }
+        }
+    }
+}
+
+template <typename Func>
+void Density::_forEachNearby(
+    const kln::point& p1, float radius, Func&& func
+) const {
+    switch (_structure) {
+    case Backend::HashMap: _forEachInMap(p1, radius, func); break;
+    case Backend::SortedGrid: _forEachInGrid(p1, radius, func); break;
+    case Backend::FlatHash: _forEachInHash(p1, radius, func); break;
+    }
+}
+
+template <typename Func>
+void Density::_forEachInGrid(
+    const kln::point& p1, float radius, Func&& func
+) const {
+    _forEachGridRow(p1, radius, [&](uint first, uint last) {
+        for (auto i = first; i < last; ++i) {
+            func(_sortedIndices[i], _sortedPositions[i]);
+        }
+    });
+}
+
+template <typename Func>
+void Density::_forEachGridRow(
+    const kln::point& p1, float radius, Func&& func
+) const {
+    if (_cellStart.size() <= 1)
+        return;
+    auto halfSize = static_cast<int>(std::ceil(radius / gridCellSize));
+    auto center = _cell(p1);
+    auto lo = _clampToGrid(center - glm::ivec3(halfSize));
+    auto hi = _clampToGrid(center + glm::ivec3(halfSize));
+
+    // The cells of a row along x are contiguous in the sorted arrays
+    for (int z = lo.z; z <= hi.z; ++z) {
+        for (int y = lo.y; y <= hi.y; ++y) {
+            auto row = _gridIndex({lo.x, y, z});
+            func(_cellStart[row], _cellStart[row + (hi.x - lo.x) + 1]);
+        }
+    }
+}
+
+template <typename Func>
+void Density::_forEachInMap(
+    const kln::point& p1, float radius, Func&& func
+) const {
+    auto centerCell = _cell(p1);
+    auto halfSize = static_cast<int>(std::ceil(radius / gridCellSize));
+
+    for (int x = -halfSize; x <= halfSize; ++x) {
+        for (int y = -halfSize; y <= halfSize; ++y) {
+            for (int z = -halfSize; z <= halfSize; ++z) {
+                auto cell = glm::ivec3(
+                    centerCell.x + x, centerCell.y + y, centerCell.z + z
+                );
+                auto range = _particleMap.equal_range(cell);
+
+                for (auto it = range.first; it != range.second; ++it) {
+                    func(it->second, _positions[it->second]);
+                }
+            }
+        }
     }
 }
 
-const std::vector<glm::ivec3>& Density::nearbyCells(const kln::point& p1
+template <typename Func>
+void Density::_forEachInHash(
+    const kln::point& p1, float radius, Func&& func
+) const {
+    _forEachHashRow(p1, radius, [&](uint first, uint last) {
+        for (auto i = first; i < last; ++i) {
+            func(_sortedIndices[i], _sortedPositions[i]);
+        }
+    });
+}
+
+template <typename Func>
+void Density::_forEachHashRow(
+    const kln::point& p1, float radius, Func&& func
+) const {
+    auto center = _cell(p1);
+    auto halfSize = static_cast<int>(std::ceil(radius / gridCellSize));
+    for (int z = -halfSize; z <= halfSize; ++z) {
+        for (int y = -halfSize; y <= halfSize; ++y) {
+            auto slot = _findSlot(center + glm::ivec3(0, y, z));
+            if (!slot)
+                continue;
+            auto [first, last] = _rowRange(
+                *slot, center.x - halfSize, center.x + halfSize
+            );
+            if (first < last)
+                func(first, last);
+        }
+    }
+}
+
+void Density::nearbyCells(
+    const kln::point& p1, std::vector<glm::ivec3>& cells
 ) const {
     auto cell = _cell(p1);
     auto halfSize = static_cast<int>(std::ceil(lookupRadius / gridCellSize));
-    auto size = halfSize * 2 + 1;
     float squaredRadius = lookupRadius * lookupRadius;
     glm::vec3 centerPos(p1.x(), p1.y(), p1.z());
 
-    // std::vector<glm::ivec3> cells;
-    _cellCache.clear();
-    _cellCache.reserve(size * size * size / 2);
-
+    cells.clear();
     for (int x = -halfSize; x <= halfSize; ++x) {
         for (int y = -halfSize; y <= halfSize; ++y) {
             for (int z = -halfSize; z <= halfSize; ++z) {
-                // cells.emplace_back(cell.x + x, cell.y + y, cell.z + z);
-                glm::vec3 cellCenter = cellInSpace(glm::ivec3(
-                    centerPos.x + x, centerPos.y + y, centerPos.z + z
-                ));
-                auto diff = cellCenter - centerPos;
-                float squaredDist = glm::dot(diff, diff);
-
-                if (squaredDist <= squaredRadius) {
-                    _cellCache.emplace_back(
-                        centerPos.x + x, centerPos.y + y, centerPos.z + z
-                    );
+                auto other = cell + glm::ivec3(x, y, z);
+                auto diff = cellInSpace(other) - centerPos;
+                if (glm::dot(diff, diff) <= squaredRadius) {
+                    cells.push_back(other);
                 }
             }
         }
     }
-    return _cellCache;
 }
 
-const std::vector<Particle*>& Density::nearbyParticles(const kln::point& p1
+void Density::nearbyParticles(
+    const kln::point& p1, std::vector<std::size_t>& indices
 ) const {
-    _particleCache.clear();
-    // std::vector<Particle*> particles;
-    auto cells = nearbyCells(p1);
+    indices.clear();
+    _forEachNearby(
+        p1, lookupRadius,
+        [&](uint index, const kln::point& position) {
+            if ((p1 & position).norm() <= lookupRadius)
+                indices.push_back(index);
+        }
+    );
+}
 
-    // Reserve a reasonable amount based on typical density
-    _particleCache.reserve(cells.size() * 4);
-    // Assuming ~4 particles per cell on average
+void Density::nearbyParticles(
+    std::span<const kln::point> points, Neighbors& neighbors
+) const {
+    PROFILE_ZONE("Neighbor queries");
+    auto count = points.size();
+    neighbors.offsets.assign(count + 1, 0);
+    neighbors.indices.clear();
+    if (count == 0)
+        return;
 
-    for (const auto& cell : cells) {
-        auto range = _particleMap.equal_range(cell);
-        for (auto it = range.first; it != range.second; ++it) {
-            // auto particle = it->second;
-            // particles.push_back(particle);
-            _particleCache.push_back(it->second);
+    // The queries sorted along the cells, then split in groups of one cell
+    auto queries = mortonOrder(points, gridCellSize);
+    std::vector<std::size_t> groups;
+    for (std::size_t s = 0; s < count; ++s) {
+        if (s == 0 ||
+            _cell(points[queries[s]]) != _cell(points[queries[s - 1]]))
+            groups.push_back(s);
+    }
+    groups.push_back(count);
+
+    // Each chunk of groups gathers its own results, which are then copied in
+    // place. starts[q] is where the results of q begin in its chunk.
+    struct Chunk {
+        std::size_t begin, end;
+        std::vector<std::size_t> indices;
+    };
+    std::mutex mutex;
+    std::vector<Chunk> chunks;
+    std::vector<std::size_t> starts(count);
+    auto groupCount = groups.size() - 1;
+    parallelChunks("Queries chunk", groupCount, [&](auto begin, auto end) {
+        std::vector<std::size_t> indices;
+        // What the points of a cell share: the slots of the rows around it
+        // in the sorted grid, or the particles of the cells around it in the
+        // map, which are slower to find
+        std::vector<std::pair<uint, uint>> rows;
+        std::vector<std::pair<uint, kln::point>> candidates;
+        const auto query = [&](uint q, auto&& forEach) {
+            const auto& p1 = points[q];
+            starts[q] = indices.size();
+            forEach([&](uint index, const kln::point& position) {
+                if ((p1 & position).norm() <= lookupRadius)
+                    indices.push_back(index);
+            });
+            neighbors.offsets[q + 1] = indices.size() - starts[q];
+        };
+        for (auto g = begin; g < end; ++g) {
+            const auto& center = points[queries[groups[g]]];
+            rows.clear();
+            const auto addRow = [&](uint a, uint b) {
+                rows.emplace_back(a, b);
+            };
+            if (_structure == Backend::SortedGrid) {
+                _forEachGridRow(center, lookupRadius, addRow);
+            } else if (_structure == Backend::FlatHash) {
+                _forEachHashRow(center, lookupRadius, addRow);
+            } else {
+                candidates.clear();
+                _forEachInMap(
+                    center, lookupRadius,
+                    [&](uint index, const kln::point& position) {
+                        candidates.emplace_back(index, position);
+                    }
+                );
+            }
+            for (auto s = groups[g]; s < groups[g + 1]; ++s) {
+                query(queries[s], [&](auto&& func) {
+                    for (auto [first, last] : rows) {
+                        for (auto i = first; i < last; ++i) {
+                            func(_sortedIndices[i], _sortedPositions[i]);
+                        }
+                    }
+                    for (const auto& [index, position] : candidates) {
+                        func(index, position);
+                    }
+                });
+            }
         }
+        std::scoped_lock lock(mutex);
+        chunks.push_back({begin, end, std::move(indices)});
+    });
+    std::inclusive_scan(
+        neighbors.offsets.begin(), neighbors.offsets.end(),
+        neighbors.offsets.begin()
+    );
+    neighbors.indices.resize(neighbors.offsets.back());
+    parallelFor(
+        chunks.size(),
+        [&](std::size_t c) {
+            const auto& chunk = chunks[c];
+            for (auto s = groups[chunk.begin]; s < groups[chunk.end]; ++s) {
+                auto q = queries[s];
+                auto first = chunk.indices.begin() + starts[q];
+                auto last = first + (neighbors.offsets[q + 1] -
+                                     neighbors.offsets[q]);
+                std::copy(
+                    first, last,
+                    neighbors.indices.begin() + neighbors.offsets[q]
+                );
+            }
+        },
+        1
+    );
+}
+
+void Density::kNearest(
+    const kln::point& p1, std::size_t k, std::vector<Nearest>& nearest
+) const {
+    nearest.clear();
+    k = std::min(k, _positions.size());
+    if (k == 0)
+        return;
+
+    // Max heap of the best ones so far, the k-th best on top
+    const auto further = [](const Nearest& a, const Nearest& b) {
+        return a.distance < b.distance;
+    };
+    const auto consider = [&](uint index, const kln::point& position) {
+        float distance = (p1 & position).norm();
+        if (nearest.size() < k) {
+            nearest.push_back({index, distance});
+            std::ranges::push_heap(nearest, further);
+        } else if (distance < nearest.front().distance) {
+            std::ranges::pop_heap(nearest, further);
+            nearest.back() = {index, distance};
+            std::ranges::push_heap(nearest, further);
+        }
+    };
+
+    // The search starts from the closest occupied cell. The sorted grid
+    // holds the particles outside of it in its border cells.
+    auto [min, max] = _cellBounds();
+    auto center = glm::clamp(_cell(p1), min, max);
+    glm::vec3 position(p1.x(), p1.y(), p1.z());
+    for (int ring = 0;; ++ring) {
+        if (!_forEachInRing(center, ring, consider))
+            break;
+        if (nearest.size() < k)
+            continue;
+
+        // The next rings are beyond one of the faces of this one, except
+        // the faces on the bounds, with no cells beyond them. Their
+        // particles are in the part of the occupied space past that face.
+        auto bound = std::numeric_limits<float>::max();
+        const auto boundBeyond = [&](int axis, int cell, bool above) {
+            auto lo = (glm::vec3(_occupiedMin) - .5f) * gridCellSize;
+            auto hi = (glm::vec3(_occupiedMax) + .5f) * gridCellSize;
+            auto face = (cell + (above ? .5f : -.5f)) * gridCellSize;
+            (above ? lo : hi)[axis] = face;
+            auto outside = glm::max(lo - position, position - hi);
+            outside = glm::max(outside, glm::vec3(0.f));
+            bound = std::min(bound, glm::length(outside));
+        };
+        for (int axis = 0; axis < 3; ++axis) {
+            if (center[axis] - ring > min[axis])
+                boundBeyond(axis, center[axis] - ring, false);
+            if (center[axis] + ring < max[axis])
+                boundBeyond(axis, center[axis] + ring, true);
+        }
+        if (bound >= nearest.front().distance)
+            break;
     }
-    // return particles;
-    return _particleCache;
+    std::ranges::sort_heap(nearest, further);
 }
 
-void Density::applyForce(const Second& deltaTime, Particle& p1) {
-    p1.applyForce(_calculateForce(p1), deltaTime);
+template <typename Func>
+bool Density::_forEachInRing(
+    const glm::ivec3& center, int ring, Func&& func
+) const {
+    auto [min, max] = _cellBounds();
+    auto lo = center - glm::ivec3(ring);
+    auto hi = center + glm::ivec3(ring);
+    // Past all the occupied cells
+    bool outside = true;
+    for (int axis = 0; axis < 3; ++axis) {
+        outside &= lo[axis] < min[axis] && hi[axis] > max[axis];
+    }
+    if (outside)
+        return false;
+    lo = glm::max(lo, min);
+    hi = glm::min(hi, max);
+
+    const auto forSlots = [&](uint first, uint last) {
+        for (auto i = first; i < last; ++i) {
+            func(_sortedIndices[i], _sortedPositions[i]);
+        }
+    };
+    const auto forCells = [&](int y, int z, int x0, int x1) {
+        if (_structure == Backend::HashMap) {
+            for (int x = x0; x <= x1; ++x) {
+                auto range = _particleMap.equal_range({x, y, z});
+                for (auto it = range.first; it != range.second; ++it) {
+                    func(it->second, _positions[it->second]);
+                }
+            }
+            return;
+        }
+        if (_structure == Backend::FlatHash) {
+            if (auto slot = _findSlot({x0, y, z})) {
+                auto [first, last] = _rowRange(*slot, x0, x1);
+                forSlots(first, last);
+            }
+            return;
+        }
+        forSlots(
+            _cellStart[_gridIndex({x0, y, z})],
+            _cellStart[_gridIndex({x1, y, z}) + 1]
+        );
+    };
+    // Only the faces of the cube: whole rows on the faces along y and z,
+    // and the two end cells of the rows in between
+    for (int z = lo.z; z <= hi.z; ++z) {
+        for (int y = lo.y; y <= hi.y; ++y) {
+            auto face = std::abs(z - center.z) == ring ||
+                        std::abs(y - center.y) == ring;
+            if (face) {
+                forCells(y, z, lo.x, hi.x);
+                continue;
+            }
+            if (center.x - ring >= min.x)
+                forCells(y, z, center.x - ring, center.x - ring);
+            if (center.x + ring <= max.x)
+                forCells(y, z, center.x + ring, center.x + ring);
+        }
+    }
+    return true;
+}
+
+std::pair<glm::ivec3, glm::ivec3> Density::_cellBounds() const {
+    switch (_structure) {
+    case Backend::HashMap:
+    case Backend::FlatHash: return {_occupiedMin, _occupiedMax};
+    case Backend::SortedGrid:
+        return {_gridMin, _gridMin + _gridDims - glm::ivec3(1)};
+    }
+    return {};
+}
+
+void Density::applyForce(const Second& deltaTime, Particle p1) {
+    p1.applyForce(calculateForce(_index(p1), p1.position), deltaTime);
 }
-void Density::applyForce(const Second& deltaTime, Particle& p1, Particle& p2) {
+void Density::applyForce(const Second& deltaTime, Particle p1, Particle p2) {
     applyForce(deltaTime, p1);
     applyForce(deltaTime, p2);
 }
 
-void Density::prepareForce(Particle& p1) {
-    p1.prepareForce(_calculateForce(p1));
+void Density::prepareForce(Particle p1) {
+    p1.prepareForce(calculateForce(_index(p1), p1.position));
 }
-void Density::prepareForce(Particle& p1, Particle& p2) {
+void Density::prepareForce(Particle p1, Particle p2) {
     prepareForce(p1);
     prepareForce(p2);
 }
 
-kln::translator Density::_calculateForce(const Particle& p1) const {
+kln::translator Density::calculateForce(
+    std::size_t index, const kln::point& position
+) const {
+    if (pairwise && _pairForces.size() == _positions.size())
+        return _pairForces[index];
+
     kln::translator force = {};
     // for (auto& particle : nearbyParticles(p1.position)) {
     //     if (particle == &p1)
@@ -115,42 +993,41 @@ kln::translator Density::_calculateForce(const Particle& p1) const {
     //     );
     // }
 
-    auto centerCell = _cell(p1.position);
-    auto halfSize = static_cast<int>(std::ceil(lookupRadius / gridCellSize));
-    float squaredRadius = lookupRadius * lookupRadius;
-
-    for (int x = -halfSize; x <= halfSize; ++x) {
-        for (int y = -halfSize; y <= halfSize; ++y) {
-            for (int z = -halfSize; z <= halfSize; ++z) {
-                auto cell = glm::ivec3(
-                    centerCell.x + x, centerCell.y + y, centerCell.z + z
-                );
-                auto range = _particleMap.equal_range(cell);
-
-                for (auto it = range.first; it != range.second; ++it) {
-                    Particle* particle = it->second;
-                    if (particle == &p1)
-                        continue; // Skip self
-
-                    float distance = (p1.position & particle->position).norm();
-                    if (distance <= lookupRadius) {
-                        float factor = glm::smoothstep(
-                            repulsionFactor, 0.f,
-                            inverseLerp(0.f, lookupRadius, distance)
-                        );
-                        auto direction =
-                            (p1.position - particle->position) / distance;
-                        force += kln::translator(
-                            factor, direction.x(), direction.y(), direction.z()
-                        );
-                    }
-                }
-            }
+    if (_hasLists() && !pairwise) {
+        auto last = _neighborStart[index + 1];
+        for (auto e = _neighborStart[index]; e < last; ++e) {
+            force += _repulsion(position, _positions[_neighbors[e]]);
         }
+        return force;
     }
+
+    _forEachNearby(
+        position, lookupRadius,
+        [&](uint other, const kln::point& p2) {
+            if (other != index)
+                force += _repulsion(position, p2);
+        }
+    );
     return force;
 }
 
+kln::translator Density::_repulsion(
+    const kln::point& p1, const kln::point& p2
+) const {
+    float distance = (p1 & p2).norm();
+    if (distance > lookupRadius)
+        return {};
+    float factor = glm::smoothstep(
+        repulsionFactor, 0.f, inverseLerp(0.f, lookupRadius, distance)
+    );
+    auto direction = (p1 - p2) / distance;
+    return kln::translator(factor, direction.x(), direction.y(), direction.z());
+}
+
+std::size_t Density::_index(const Particle& p1) const {
+    return &p1.position - _particles->positions().data();
+}
+
 glm::ivec3 Density::_cell(const kln::point& p1) const {
     return glm::ivec3(
         static_cast<int>(std::round(p1.x() / gridCellSize)),
@@ -161,3 +1038,32 @@ glm::ivec3 Density::_cell(const kln::point& p1) const {
 glm::ivec3 Density::_cell(const Particle& p1) const {
     return _cell(p1.position);
 }
+glm::ivec3 Density::_clampToGrid(const glm::ivec3& c) const {
+    return glm::clamp(c, _gridMin, _gridMin + _gridDims - glm::ivec3(1));
+}
+Density::uint Density::_gridIndex(const glm::ivec3& c) const {
+    auto local = c - _gridMin;
+    return local.x + _gridDims.x * (local.y + _gridDims.y * local.z);
+}
+const Density::HashSlot* Density::_findSlot(const glm::ivec3& c) const {
+    if (_hashSlots.empty())
+        return nullptr;
+    auto key = packRow(c);
+    auto mask = _hashSlots.size() - 1;
+    for (auto s = mixHash(key) & mask;; s = (s + 1) & mask) {
+        const auto& slot = _hashSlots[s];
+        if (slot.key == key)
+            return &slot;
+        if (slot.key == EMPTY_ROW)
+            return nullptr;
+    }
+}
+std::pair<Density::uint, Density::uint> Density::_rowRange(
+    const HashSlot& slot, int x0, int x1
+) const {
+    auto begin = _sortedX.begin() + slot.first;
+    auto end = begin + slot.count;
+    auto first = std::lower_bound(begin, end, x0);
+    auto last = std::upper_bound(first, end, x1);
+    return {uint(first - _sortedX.begin()), uint(last - _sortedX.begin())};
+}
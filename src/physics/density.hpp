@@ -1,10 +1,16 @@
 #pragma once
 
+#include "ParticleSystem.hpp"
 #include "base.hpp"
 #include "links.hpp"
+#include <cstdint>
 #include <glm/glm.hpp>
 #include <klein/klein.hpp>
+#include <span>
+#include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 // Required for unordered_map to work with glm types
 #define GLM_ENABLE_EXPERIMENTAL
@@ -12,26 +18,111 @@
 
 class Density : public Link {
 public:
+    enum class Backend {
+        HashMap,    // Multimap of cells, updated on each particle move
+        SortedGrid, // Flat grid, rebuilt by a counting sort once per step
+        FlatHash,   // Open addressing table of the occupied rows of cells,
+                    // rebuilt by a counting sort once per step
+    };
+
     Density() = default;
-    Density(float repulsionFactor, float lookupRadius, float gridCellSize)
+    Density(
+        float repulsionFactor, float lookupRadius, float gridCellSize,
+        Backend backend = Backend::SortedGrid, float skin = 0.f
+    )
         : repulsionFactor(repulsionFactor),
           lookupRadius(lookupRadius),
-          gridCellSize(gridCellSize) {}
+          gridCellSize(gridCellSize),
+          skin(skin),
+          _backend(backend) {}
 
     float repulsionFactor = 1.f; // Factor to control the repulsion force
     float lookupRadius = 1.f;    // Radius for looking up particles in the grid
     float gridCellSize = 1.f;    // Size of the grid cell for spatial hashing
+    // Margin of the neighbor lists, 0 to look the neighbors up in the grid
+    // on every step instead
+    float skin = 0.f;
+    // Evaluates each pair of particles once, in prepareForces(), and applies
+    // it to both sides
+    bool pairwise = true;
+
+    void setParticles(ParticleSystem&);
+    // Moves the particles to their new cells.
+    // Call it once per step, after the particles have been integrated.
+    void update();
+    // Accumulates the pairwise forces read by calculateForce().
+    // Call it once per step, before the forces are applied.
+    void prepareForces();
+
+    Backend backend() const { return _backend; }
+    // The sorted grid falls back on the flat hash while the particles are
+    // too spread out for it
+    void setBackend(Backend backend);
+
+    // Bytes held by the cells of the current backend. The nodes of the hash
+    // map are estimated.
+    std::size_t memoryUsage() const;
+
+    // Number of times the neighbor lists have been built
+    std::size_t neighborRebuilds() const { return _rebuilds; }
+
+    // Neighbors of a batch of points: the particles around the point q are
+    // indices[offsets[q] .. offsets[q + 1]]
+    struct Neighbors {
+        std::vector<std::size_t> offsets;
+        std::vector<std::size_t> indices;
+
+        std::size_t size() const {
+            return offsets.empty() ? 0 : offsets.size() - 1;
+        }
+        std::span<const std::size_t> operator[](std::size_t q) const {
+            return {
+                indices.data() + offsets[q], indices.data() + offsets[q + 1]
+            };
+        }
+    };
+
+    // The queries below only read the grid, and write into the caller's
+    // vectors, so they can run from several threads at once between two
+    // update(). The vectors keep their capacity from one call to the next.
+
+    // Cells whose center is within lookupRadius of p1
+    void nearbyCells(const kln::point& p1, std::vector<glm::ivec3>& cells)
+        const;
+    // Indices of the particles within lookupRadius of p1
+    void nearbyParticles(
+        const kln::point& p1, std::vector<std::size_t>& indices
+    ) const;
+    // Indices of the particles around each point. The points of a same cell
+    // share the lookup of the cells around it.
+    void nearbyParticles(
+        std::span<const kln::point> points, Neighbors& neighbors
+    ) const;
+
+    struct Nearest {
+        std::size_t index;
+        float distance;
+    };
+    // The k particles closest to p1, from the nearest, fewer if there are
+    // not that many. The shells of cells around p1 are searched outward
+    // until they are further than the k-th best.
+    void kNearest(
+        const kln::point& p1, std::size_t k, std::vector<Nearest>& nearest
+    ) const;
 
-    void setParticles(std::vector<Particle>&);
-    const std::vector<glm::ivec3>& nearbyCells(const kln::point& p1) const;
-    const std::vector<Particle*>& nearbyParticles(const kln::point& p1) const;
+    // Repulsion on the particle `index`, from the positions of the last
+    // update(), so that it can run while the particles move.
+    // In pairwise mode, it is the one of the last prepareForces().
+    kln::translator calculateForce(
+        std::size_t index, const kln::point& position
+    ) const;
 
-    void applyForce(const Second& deltaTime, Particle& p1) override;
-    void applyForce(const Second& deltaTime, Particle& p1, Particle& p2)
+    void applyForce(const Second& deltaTime, Particle p1) override;
+    void applyForce(const Second& deltaTime, Particle p1, Particle p2)
         override;
 
-    void prepareForce(Particle& p1) override;
-    void prepareForce(Particle& p1, Particle& p2) override;
+    void prepareForce(Particle p1) override;
+    void prepareForce(Particle p1, Particle p2) override;
 
     glm::ivec3 cell(const kln::point& p1) const { return _cell(p1); }
     glm::vec3 cellInSpace(const kln::point& p1) const {
@@ -43,13 +134,139 @@ public:
 
 private:
     using uint = unsigned int;
-    std::unordered_multimap<glm::ivec3, Particle*> _particleMap {};
+    Backend _backend = Backend::SortedGrid;
+    // What the last rebuild built: the sorted grid falls back to the flat
+    // hash while the particles spread too far for it
+    Backend _structure = Backend::SortedGrid;
+    ParticleSystem* _particles = nullptr;
 
-    mutable std::vector<glm::ivec3> _cellCache;
-    mutable std::vector<Particle*> _particleCache;
+    std::unordered_multimap<glm::ivec3, uint> _particleMap {};
+    std::vector<glm::ivec3> _mapCells;
+    std::vector<glm::ivec3> _newCells;
 
-    kln::translator _calculateForce(const Particle& p1) const;
+    // Sorted grid: the particles of the cell `c` are
+    // _sortedIndices[_cellStart[c] .. _cellStart[c + 1]]
+    glm::ivec3 _gridMin {};
+    glm::ivec3 _gridDims {};
+    std::vector<uint> _cellStart;
+    std::vector<uint> _sortedIndices;
+    std::vector<kln::point> _sortedPositions;
+    std::vector<uint> _particleCells;
+    std::vector<uint> _cellCursor;
+
+    // Flat hash: the particles of the row of cells along x in the slot s are
+    // _sortedIndices[_hashSlots[s].first .. + _hashSlots[s].count], by
+    // increasing cell x, which _sortedX keeps. The table has a power of two
+    // size, and is probed linearly from the hash of the packed row.
+    static constexpr std::uint64_t EMPTY_ROW = ~std::uint64_t(0);
+    struct HashSlot {
+        std::uint64_t key = EMPTY_ROW;
+        uint first = 0;
+        uint count = 0;
+    };
+    std::vector<HashSlot> _hashSlots;
+    // Occupied slots, by increasing key
+    std::vector<uint> _hashRows;
+    std::vector<int> _sortedX;
+    std::vector<uint> _particleSlots;
+
+    // Positions of the last update, by particle index
+    std::vector<kln::point> _positions;
+    // Bounds of the cells of all the particles
+    glm::ivec3 _occupiedMin {};
+    glm::ivec3 _occupiedMax {};
+
+    // Verlet lists: the particles that were within lookupRadius + skin of
+    // the particle i when the lists were built are
+    // _neighbors[_neighborStart[i] .. _neighborStart[i + 1]]
+    std::vector<uint> _neighborStart;
+    std::vector<uint> _neighbors;
+    std::vector<kln::point> _listPositions;
+    float _listRadius = 0.f; // 0 while there are no lists
+    bool _listsPairwise = false; // Lists of the neighbors j > i only
+    std::size_t _rebuilds = 0;
+
+    // Pairwise mode: each chunk of prepareForces() accumulates into its own
+    // buffer, over its keys and the later ones its pairs reach. The buffers
+    // are then summed into _pairForces, in the order of the chunks.
+    std::vector<std::vector<kln::translator>> _chunkForces;
+    std::vector<std::size_t> _firstChunks;
+    std::vector<kln::translator> _pairForces;
+
+    // Builds the structure of the backend from scratch
+    void _rebuild();
+    void _fillMap();
+    void _updateMap();
+    void _updateOccupied();
+    void _rebuildGrid();
+    void _rebuildHash();
+    void _updateLists();
+    void _buildLists(float radius);
+    bool _hasLists() const;
+
+    // Calls func(index, position) for the particles in the cells around p1,
+    // up to `radius` away
+    template <typename Func>
+    void _forEachNearby(const kln::point& p1, float radius, Func&& func) const;
+    template <typename Func>
+    void _forEachInGrid(const kln::point& p1, float radius, Func&& func) const;
+    // Calls func(first, last) for the ranges of sorted slots of the rows of
+    // cells around p1
+    template <typename Func>
+    void _forEachGridRow(const kln::point& p1, float radius, Func&& func)
+        const;
+    template <typename Func>
+    void _forEachInMap(const kln::point& p1, float radius, Func&& func) const;
+    template <typename Func>
+    void _forEachInHash(const kln::point& p1, float radius, Func&& func)
+        const;
+    // Calls func(first, last) for the ranges of sorted slots of the rows of
+    // cells around p1 in the flat hash
+    template <typename Func>
+    void _forEachHashRow(const kln::point& p1, float radius, Func&& func)
+        const;
+    // Calls func(index, position) for the particles of the cells exactly
+    // `ring` cells away from `center`, on the largest axis. Returns false
+    // once there are no such cells in the grid anymore.
+    template <typename Func>
+    bool _forEachInRing(const glm::ivec3& center, int ring, Func&& func)
+        const;
+    // Lowest and highest cells that may hold particles
+    std::pair<glm::ivec3, glm::ivec3> _cellBounds() const;
+    // Calls func(a, b, pa, pb) once for each pair of particles that may be
+    // within lookupRadius, with a in [begin, end) and b > a. The keys a and
+    // b are the particle indices with the lists and the map, and the sorted
+    // slots with the sorted grid and the flat hash.
+    template <typename Func>
+    void _forEachPair(std::size_t begin, std::size_t end, Func&& func) const;
+
+    std::size_t _index(const Particle& p1) const;
+    kln::translator _repulsion(
+        const kln::point& p1, const kln::point& p2
+    ) const;
 
     glm::ivec3 _cell(const kln::point& p1) const;
     glm::ivec3 _cell(const Particle& p1) const;
+    glm::ivec3 _clampToGrid(const glm::ivec3& c) const;
+    uint _gridIndex(const glm::ivec3& c) const;
+    // Slot of the row of the cell c in the flat hash, nullptr when it is
+    // empty
+    const HashSlot* _findSlot(const glm::ivec3& c) const;
+    // Sorted slots of the particles of a row with a cell x in [x0, x1]
+    std::pair<uint, uint> _rowRange(const HashSlot& slot, int x0, int x1)
+        const;
+};
+
+inline std::string to_string(Density::Backend backend) {
+    switch (backend) {
+    case Density::Backend::HashMap: return "Hash map";
+    case Density::Backend::SortedGrid: return "Sorted grid";
+    case Density::Backend::FlatHash: return "Flat hash";
+    }
+    return "Unknown";
+}
+const auto density_backends = {
+    Density::Backend::HashMap,
+    Density::Backend::SortedGrid,
+    Density::Backend::FlatHash,
 };
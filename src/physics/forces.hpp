@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <klein/klein.hpp>
+#include <tuple>
+
+// Force fields composed at compile time.
+// Each field provides a non virtual
+//     kln::translator calculateForce(std::size_t index, const kln::point&)
+// and the set is called like a single field, so that the particle loops
+// inline every force instead of going through the Link interface.
+template <typename... Fields>
+class ForceSet {
+public:
+    explicit ForceSet(const Fields&... fields)
+        : _fields(fields...) {}
+
+    kln::translator operator()(
+        std::size_t index, const kln::point& position
+    ) const {
+        kln::translator force = {};
+        std::apply(
+            [&](const auto&... field) {
+                ((force += field.calculateForce(index, position)), ...);
+            },
+            _fields
+        );
+        return force;
+    }
+
+private:
+    std::tuple<const Fields&...> _fields;
+};
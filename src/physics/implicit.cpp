@@ -0,0 +1,173 @@
+#include "implicit.hpp"
+#include "utils/parallel.hpp"
+#include "utils/types.hpp"
+#include <algorithm>
+
+static float dot(
+    const std::vector<glm::vec3>& a, const std::vector<glm::vec3>& b
+) {
+    return parallelSum(a.size(), 0.f, [&](std::size_t i) {
+        return glm::dot(a[i], b[i]);
+    });
+}
+
+void ImplicitSolver::assemble(
+    const ParticleSystem& particles, const SpringAdjacency& adjacency
+) {
+    auto positions = particles.positions();
+    auto velocities = particles.velocities();
+    auto rowStart = adjacency.rowStart();
+    auto others = adjacency.others();
+    auto lengths = adjacency.lengths();
+    auto stiffnesses = adjacency.stiffnesses();
+    auto viscosities = adjacency.viscosities();
+
+    _jacobians.resize(others.size());
+    _springForces.resize(particles.size());
+
+    // The rows of the static and sleeping particles are never read
+    auto locks = particles.locks();
+    auto first = particles.staticCount();
+    parallelFor(particles.size() - first, [&](std::size_t k) {
+        auto i = first + k;
+        if (locks[i])
+            return;
+        auto xi = pointToVec(positions[i]);
+        auto vi = translatorToVec(velocities[i]);
+        glm::vec3 force(0.f);
+        for (auto e = rowStart[i]; e < rowStart[i + 1]; ++e) {
+            auto j = others[e];
+            auto delta = pointToVec(positions[j]) - xi;
+            auto d = glm::length(delta);
+            if (d == 0) {
+                _jacobians[e] = glm::mat3(0.f);
+                continue;
+            }
+            auto n = delta / d;
+            auto k = stiffnesses[e];
+            auto l0 = lengths[e];
+
+            // Same force as springForce(): k (1 - l0 / d) along n
+            force += n * (k * (1 - l0 / d)) +
+                     (translatorToVec(velocities[j]) - vi) * viscosities[e];
+
+            // Jacobian over the other end. The transverse term is clamped
+            // to keep the system definite while the spring is compressed.
+            auto nn = glm::outerProduct(n, n);
+            auto transverse = std::max(k * (1 - l0 / d) / d, 0.f);
+            _jacobians[e] = nn * (k * l0 / (d * d)) +
+                            (glm::mat3(1.f) - nn) * transverse;
+        }
+        _springForces[i] = force;
+    });
+}
+
+void ImplicitSolver::_multiply(
+    const ParticleSystem& particles, const SpringAdjacency& adjacency,
+    float deltaTime, const std::vector<glm::vec3>& in,
+    std::vector<glm::vec3>& out
+) const {
+    auto h = deltaTime;
+    auto locks = particles.locks();
+    auto rowStart = adjacency.rowStart();
+    auto others = adjacency.others();
+    auto viscosities = adjacency.viscosities();
+
+    parallelFor(particles.size(), [&](std::size_t i) {
+        if (locks[i]) {
+            out[i] = glm::vec3(0.f);
+            return;
+        }
+        auto result = _masses[i] * in[i];
+        for (auto e = rowStart[i]; e < rowStart[i + 1]; ++e) {
+            auto diff = in[i] - in[others[e]];
+            result += diff * (h * viscosities[e]) +
+                      (_jacobians[e] * diff) * (h * h);
+        }
+        out[i] = result;
+    });
+}
+
+void ImplicitSolver::solve(
+    ParticleSystem& particles, const SpringAdjacency& adjacency,
+    float deltaTime
+) {
+    auto h = deltaTime;
+    auto count = particles.size();
+    auto velocities = particles.velocities();
+    auto forces = particles.forces();
+    auto inverseMasses = particles.inverseMasses();
+    auto locks = particles.locks();
+    auto rowStart = adjacency.rowStart();
+    auto others = adjacency.others();
+    auto viscosities = adjacency.viscosities();
+
+    for (auto* vector :
+         {&_masses, &_inverseDiagonal, &_b, &_x, &_r, &_z, &_p, &_q}) {
+        vector->resize(count);
+    }
+
+    // Right-hand side, and the diagonal of the matrix for the preconditioner
+    parallelFor(count, [&](std::size_t i) {
+        auto mass = glm::vec3(1.f / inverseMasses[i]);
+        _masses[i] = mass;
+        if (locks[i]) {
+            _b[i] = glm::vec3(0.f);
+            _inverseDiagonal[i] = glm::vec3(0.f);
+            return;
+        }
+        auto vi = translatorToVec(velocities[i]);
+        auto stiffnessTerm = glm::vec3(0.f);
+        auto diagonal = mass;
+        for (auto e = rowStart[i]; e < rowStart[i + 1]; ++e) {
+            auto vj = translatorToVec(velocities[others[e]]);
+            stiffnessTerm += _jacobians[e] * (vj - vi);
+            for (int c = 0; c < 3; ++c) {
+                diagonal[c] +=
+                    h * viscosities[e] + h * h * _jacobians[e][c][c];
+            }
+        }
+        _b[i] = (_springForces[i] + mass * translatorToVec(forces[i]) +
+                 stiffnessTerm * h) *
+                h;
+        _inverseDiagonal[i] = glm::vec3(1.f) / diagonal;
+    });
+
+    // Preconditioned conjugate gradient, starting from dv = 0
+    std::fill(_x.begin(), _x.end(), glm::vec3(0.f));
+    std::copy(_b.begin(), _b.end(), _r.begin());
+    parallelFor(count, [&](std::size_t i) {
+        _z[i] = _r[i] * _inverseDiagonal[i];
+    });
+    std::copy(_z.begin(), _z.end(), _p.begin());
+
+    auto bNorm2 = dot(_b, _b);
+    auto threshold = tolerance * tolerance * bNorm2;
+    auto rz = dot(_r, _z);
+    auto rNorm2 = bNorm2;
+    _iterations = 0;
+    while (_iterations < maxIterations && rNorm2 > threshold) {
+        _multiply(particles, adjacency, h, _p, _q);
+        auto alpha = rz / dot(_p, _q);
+        parallelFor(count, [&](std::size_t i) {
+            _x[i] += _p[i] * alpha;
+            _r[i] -= _q[i] * alpha;
+            _z[i] = _r[i] * _inverseDiagonal[i];
+        });
+        ++_iterations;
+
+        rNorm2 = dot(_r, _r);
+        auto rzNext = dot(_r, _z);
+        auto beta = rzNext / rz;
+        rz = rzNext;
+        parallelFor(count, [&](std::size_t i) {
+            _p[i] = _z[i] + _p[i] * beta;
+        });
+    }
+    _residual = bNorm2 > 0 ? std::sqrt(rNorm2 / bNorm2) : 0.f;
+
+    // Hand the velocity change to the integration, as an acceleration
+    parallelFor(count, [&](std::size_t i) {
+        forces[i] = vecToTranslator(_x[i] / h);
+    });
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "ParticleSystem.hpp"
+#include "springs.hpp"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Backward Euler integration of the springs.
+// Solves (M - h D - h^2 K) dv = h (f + M a + h K v) for the velocity change dv,
+// where K and D are the jacobians of the spring forces over the positions and
+// the velocities, with a Jacobi-preconditioned conjugate gradient. The matrix
+// is never built: it is applied link by link from the spring adjacency.
+class ImplicitSolver {
+public:
+    int maxIterations = 64;
+    float tolerance = 1e-4f; // Relative to the norm of the right-hand side
+
+    // Evaluates the spring forces and their jacobians at the current state
+    void assemble(const ParticleSystem& particles, const SpringAdjacency&);
+
+    // Solves the velocity change of a step of deltaTime.
+    // The forces of the particles must hold the other accelerations (gravity,
+    // wind...), and are replaced by dv / deltaTime, so that
+    // ParticleSystem::integrate applies the velocity change.
+    void solve(
+        ParticleSystem& particles, const SpringAdjacency&, float deltaTime
+    );
+
+    int iterations() const { return _iterations; }
+    float residual() const { return _residual; }
+
+private:
+    // One jacobian of the elastic force per adjacency entry
+    std::vector<glm::mat3> _jacobians;
+    std::vector<glm::vec3> _springForces;
+
+    std::vector<glm::vec3> _masses;
+    std::vector<glm::vec3> _inverseDiagonal;
+    std::vector<glm::vec3> _b;
+    std::vector<glm::vec3> _x;
+    std::vector<glm::vec3> _r;
+    std::vector<glm::vec3> _z;
+    std::vector<glm::vec3> _p;
+    std::vector<glm::vec3> _q;
+
+    int _iterations = 0;
+    float _residual = 0;
+
+    void _multiply(
+        const ParticleSystem& particles, const SpringAdjacency& adjacency,
+        float deltaTime, const std::vector<glm::vec3>& in,
+        std::vector<glm::vec3>& out
+    ) const;
+};
@@ -3,6 +3,20 @@
 #include "base.hpp"
 #include "klein/translator.hpp"
 
+#include <cstddef>
+
+struct SpringLink {
+    int a;
+    int b;
+    float length;
+};
+
+// Force of the spring between p1 and p2, as applied on p1
+kln::translator springForce(
+    const kln::point& p1, const kln::point& p2, const kln::translator& v1,
+    const kln::translator& v2, float length, float stiffness, float viscosity
+);
+
 class Spring : public Link {
 public:
     float length;
@@ -11,15 +25,19 @@ public:
 
     Spring(float length, float stiffness, float viscosity);
 
-    void applyForce(const Second& deltaTime, Particle& p1) override;
-    void applyForce(const Second& deltaTime, Particle& p1, Particle& p2)
+    void applyForce(const Second& deltaTime, Particle p1) override;
+    void applyForce(const Second& deltaTime, Particle p1, Particle p2)
         override;
 
-    void prepareForce(Particle& p1) override;
-    void prepareForce(Particle& p1, Particle& p2) override;
+    void prepareForce(Particle p1) override;
+    void prepareForce(Particle p1, Particle p2) override;
+    // Same, with the rest length of this specific link
+    void prepareForce(Particle p1, Particle p2, float restLength);
 
 private:
-    kln::translator _calculateForce(Particle& p1, Particle& p2);
+    kln::translator _calculateForce(
+        const Particle& p1, const Particle& p2, float restLength
+    );
 };
 
 class ConstantForce : public Link {
@@ -28,12 +46,16 @@ public:
 
     ConstantForce(const kln::translator& force);
 
-    void applyForce(const Second& deltaTime, Particle& p1) override;
-    void applyForce(const Second& deltaTime, Particle& p1, Particle& p2)
+    kln::translator calculateForce(std::size_t, const kln::point&) const {
+        return force;
+    }
+
+    void applyForce(const Second& deltaTime, Particle p1) override;
+    void applyForce(const Second& deltaTime, Particle p1, Particle p2)
         override;
 
-    void prepareForce(Particle& p1) override;
-    void prepareForce(Particle& p1, Particle& p2) override;
+    void prepareForce(Particle p1) override;
+    void prepareForce(Particle p1, Particle p2) override;
 };
 
 class Wall : public Link {
@@ -43,15 +65,22 @@ public:
 
     Wall(const kln::plane& wall, float force);
 
-    void applyForce(const Second& deltaTime, Particle& p1) override;
-    void applyForce(const Second& deltaTime, Particle& p1, Particle& p2)
+    kln::translator calculateForce(
+        std::size_t, const kln::point& position
+    ) const {
+        auto distance = position & wall;
+        if (distance.scalar() >= 0)
+            return {};
+        return kln::translator(force, wall.e1(), wall.e2(), wall.e3()) *
+               -distance.scalar();
+    }
+
+    void applyForce(const Second& deltaTime, Particle p1) override;
+    void applyForce(const Second& deltaTime, Particle p1, Particle p2)
         override;
 
-    void prepareForce(Particle& p1) override;
-    void prepareForce(Particle& p1, Particle& p2) override;
-
-private:
-    kln::translator _calculateForce(Particle& p1);
+    void prepareForce(Particle p1) override;
+    void prepareForce(Particle p1, Particle p2) override;
 };
 
 class Wind : public Link {
@@ -61,16 +90,24 @@ public:
 
     Wind(const kln::point& frequency, const kln::point& amplitude);
 
-    void applyForce(const Second& deltaTime, Particle& p1) override;
-    void applyForce(const Second& deltaTime, Particle& p1, Particle& p2)
+    // The wind is the same everywhere, evaluated once per step by update()
+    kln::translator calculateForce(std::size_t, const kln::point&) const {
+        return _force;
+    }
+
+    void applyForce(const Second& deltaTime, Particle p1) override;
+    void applyForce(const Second& deltaTime, Particle p1, Particle p2)
         override;
 
-    void prepareForce(Particle& p1) override;
-    void prepareForce(Particle& p1, Particle& p2) override;
+    void prepareForce(Particle p1) override;
+    void prepareForce(Particle p1, Particle p2) override;
 
+    // Evaluates the wind of the coming step, then advances the time
     void update(float deltaTime);
 
 private:
-    kln::translator _calculateForce(Particle& p1);
     float _time;
+    kln::translator _force;
+
+    kln::translator _calculateForce() const;
 };
@@ -3,7 +3,14 @@
 /* Spring based physics simulation by means of Geometric Algebra */
 #include <klein/klein.hpp>
 
+#include "ParticleSystem.hpp"
+#include "Profiler.hpp"
+#include "Simulation.hpp"
 #include "Time.hpp"
 #include "base.hpp"
 #include "density.hpp"
+#include "forces.hpp"
+#include "implicit.hpp"
 #include "links.hpp"
+#include "springs.hpp"
+#include "xpbd.hpp"
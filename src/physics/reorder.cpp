@@ -0,0 +1,74 @@
+#include "reorder.hpp"
+#include "utils/parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+// Spreads the 21 low bits of v, two zero bits apart
+static std::uint64_t spreadBits(std::uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffff;
+    v = (v | v << 16) & 0x1f0000ff0000ff;
+    v = (v | v << 8) & 0x100f00f00f00f00f;
+    v = (v | v << 4) & 0x10c30c30c30c30c3;
+    v = (v | v << 2) & 0x1249249249249249;
+    return v;
+}
+
+std::uint64_t mortonCode(const glm::uvec3& cell) {
+    return spreadBits(cell.x) | spreadBits(cell.y) << 1 |
+           spreadBits(cell.z) << 2;
+}
+
+std::vector<unsigned int> mortonOrder(
+    std::span<const kln::point> positions, float cellSize
+) {
+    auto count = positions.size();
+    std::vector<glm::ivec3> cells(count);
+    parallelFor(count, [&](std::size_t i) {
+        const auto& p = positions[i];
+        cells[i] = glm::ivec3(
+            static_cast<int>(std::round(p.x() / cellSize)),
+            static_cast<int>(std::round(p.y() / cellSize)),
+            static_cast<int>(std::round(p.z() / cellSize))
+        );
+    });
+    glm::ivec3 min(0);
+    if (count > 0)
+        min = cells.front();
+    for (const auto& cell : cells) {
+        min = glm::min(min, cell);
+    }
+
+    // Sorted by code, then by index, so that the order is deterministic
+    std::vector<std::pair<std::uint64_t, unsigned int>> keys(count);
+    parallelFor(count, [&](std::size_t i) {
+        keys[i] = {mortonCode(glm::uvec3(cells[i] - min)), unsigned(i)};
+    });
+    std::ranges::sort(keys);
+
+    std::vector<unsigned int> order(count);
+    for (std::size_t k = 0; k < count; ++k) {
+        order[k] = keys[k].second;
+    }
+    return order;
+}
+
+void partitionPinned(
+    std::span<unsigned int> order, std::span<const std::uint8_t> locks
+) {
+    std::ranges::stable_partition(order, [&](unsigned int i) {
+        return (locks[i] & LOCK_PINNED) != 0;
+    });
+}
+
+float orderScatter(std::span<const unsigned int> order, std::size_t near) {
+    if (order.size() < 2)
+        return 0.f;
+    auto far = parallelSum(order.size() - 1, std::size_t(0), [&](auto k) {
+        auto a = order[k];
+        auto b = order[k + 1];
+        return std::size_t((a > b ? a - b : b - a) > near);
+    });
+    return float(far) / float(order.size() - 1);
+}
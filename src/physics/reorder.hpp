@@ -0,0 +1,31 @@
+#pragma once
+
+#include "base.hpp"
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <klein/klein.hpp>
+#include <span>
+#include <vector>
+
+// Position of a cell along the Z-order curve, which keeps most of the cells
+// that are close in space close along the curve.
+// Each coordinate is taken on 21 bits, and must not be negative.
+std::uint64_t mortonCode(const glm::uvec3& cell);
+
+// Indices of the particles, sorted along the Z-order curve of their cells:
+// order[k] is the index of the k-th particle along the curve
+std::vector<unsigned int> mortonOrder(
+    std::span<const kln::point> positions, float cellSize
+);
+
+// Moves the pinned particles of `order` to its front, keeping the order
+// of both parts, so that ParticleSystem::permute leaves them static
+void partitionPinned(
+    std::span<unsigned int> order, std::span<const std::uint8_t> locks
+);
+
+// Fraction of the consecutive particles of `order` that are more than `near`
+// indices apart. Those are neighbors in space that are far apart in memory,
+// so it estimates the cache misses of the passes that walk neighbors.
+float orderScatter(std::span<const unsigned int> order, std::size_t near);
@@ -0,0 +1,211 @@
+#include "sleep.hpp"
+#include "Profiler.hpp"
+#include "utils/parallel.hpp"
+#include "utils/types.hpp"
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <numeric>
+
+void SleepTracker::build(
+    std::span<const SpringLink> links, std::size_t count
+) {
+    // Union find over the links, each set rooted at its lowest index
+    std::vector<uint> parents(count);
+    std::iota(parents.begin(), parents.end(), 0);
+    const auto find = [&](uint i) {
+        while (parents[i] != i) {
+            parents[i] = parents[parents[i]];
+            i = parents[i];
+        }
+        return i;
+    };
+    for (const auto& link : links) {
+        auto a = find(link.a);
+        auto b = find(link.b);
+        if (a != b)
+            parents[std::max(a, b)] = std::min(a, b);
+    }
+
+    // Islands numbered in the order of their lowest index
+    _islands.resize(count);
+    _sizes.clear();
+    for (uint i = 0; i < count; ++i) {
+        auto root = find(i);
+        if (root == i) {
+            _islands[i] = _sizes.size();
+            _sizes.push_back(0);
+        } else {
+            _islands[i] = _islands[root];
+        }
+        ++_sizes[_islands[i]];
+    }
+
+    auto islands = _sizes.size();
+    _calm.assign(islands, 0.f);
+    _asleep.assign(islands, false);
+    _min.assign(islands, glm::vec3(0));
+    _max.assign(islands, glm::vec3(0));
+    _fields.assign(islands, glm::vec3(0));
+    _awake = count;
+}
+
+void SleepTracker::permute(std::span<const unsigned int> order) {
+    std::vector<uint> islands(order.size());
+    for (std::size_t k = 0; k < order.size(); ++k) {
+        islands[k] = _islands[order[k]];
+    }
+    _islands.swap(islands);
+}
+
+void SleepTracker::update(ParticleSystem& particles, float deltaTime) {
+    if (!enabled || _awake == 0)
+        return;
+    PROFILE_ZONE("Sleep update");
+    auto velocities = particles.velocities();
+    auto locks = particles.locks();
+    auto islands = _sizes.size();
+
+    // Highest kinetic energy of each island, per unit mass
+    std::vector<float> energies(islands, 0.f);
+    std::mutex mutex;
+    parallelChunks("Sleep chunk", particles.size(), [&](auto begin, auto end) {
+        std::vector<float> highest(islands, 0.f);
+        for (auto i = begin; i < end; ++i) {
+            if (locks[i])
+                continue;
+            auto v = translatorToVec(velocities[i]);
+            auto& e = highest[_islands[i]];
+            e = std::max(e, .5f * glm::dot(v, v));
+        }
+        std::scoped_lock lock(mutex);
+        for (std::size_t k = 0; k < islands; ++k) {
+            energies[k] = std::max(energies[k], highest[k]);
+        }
+    });
+
+    for (uint k = 0; k < islands; ++k) {
+        if (_asleep[k])
+            continue;
+        _calm[k] = energies[k] < energy ? _calm[k] + deltaTime : 0.f;
+        if (_calm[k] >= delay)
+            _setAsleep(particles, k, true);
+    }
+}
+
+void SleepTracker::wakeTouched(
+    ParticleSystem& particles, const Density& density
+) {
+    if (!enabled || _awake == 0 || _awake == _islands.size())
+        return;
+    PROFILE_ZONE("Sleep contacts");
+    auto positions = particles.positions();
+    auto margin = glm::vec3(density.lookupRadius);
+
+    // The sleeping islands, and the bounds of them all, which most of the
+    // awake particles are out of
+    _sleeping.clear();
+    glm::vec3 min(std::numeric_limits<float>::max());
+    glm::vec3 max(std::numeric_limits<float>::lowest());
+    for (uint k = 0; k < _asleep.size(); ++k) {
+        if (!_asleep[k])
+            continue;
+        _sleeping.push_back(k);
+        min = glm::min(min, _min[k] - margin);
+        max = glm::max(max, _max[k] + margin);
+    }
+
+    // Only the awake particles close to the bounds of a sleeping island
+    // look their neighbors up
+    std::vector<uint> touched;
+    std::mutex mutex;
+    parallelChunks("Wake chunk", particles.size(), [&](auto begin, auto end) {
+        std::vector<std::size_t> nearby;
+        std::vector<uint> found;
+        for (auto i = begin; i < end; ++i) {
+            if (_asleep[_islands[i]])
+                continue;
+            auto p = pointToVec(positions[i]);
+            if (glm::clamp(p, min, max) != p)
+                continue;
+            auto close = std::ranges::any_of(_sleeping, [&](uint k) {
+                return glm::clamp(p, _min[k] - margin, _max[k] + margin) == p;
+            });
+            if (!close)
+                continue;
+            density.nearbyParticles(positions[i], nearby);
+            for (auto j : nearby) {
+                if (_asleep[_islands[j]])
+                    found.push_back(_islands[j]);
+            }
+        }
+        if (found.empty())
+            return;
+        std::scoped_lock lock(mutex);
+        touched.insert(touched.end(), found.begin(), found.end());
+    });
+    for (auto k : touched) {
+        if (_asleep[k])
+            _setAsleep(particles, k, false);
+    }
+}
+
+void SleepTracker::wakeDrifted(
+    ParticleSystem& particles, const glm::vec3& field
+) {
+    _field = field;
+    if (!enabled || _awake == _islands.size())
+        return;
+    for (uint k = 0; k < _asleep.size(); ++k) {
+        if (_asleep[k] && glm::length(field - _fields[k]) > drift)
+            _setAsleep(particles, k, false);
+    }
+}
+
+void SleepTracker::wake(ParticleSystem& particles, std::size_t index) {
+    if (index < _islands.size() && _asleep[_islands[index]])
+        _setAsleep(particles, _islands[index], false);
+}
+
+void SleepTracker::wake(ParticleSystem& particles) {
+    if (_awake == _islands.size())
+        return;
+    auto locks = particles.locks();
+    parallelFor(locks.size(), [&](std::size_t i) {
+        locks[i] &= ~LOCK_ASLEEP;
+    });
+    std::ranges::fill(_asleep, false);
+    std::ranges::fill(_calm, 0.f);
+    _awake = _islands.size();
+}
+
+void SleepTracker::_setAsleep(
+    ParticleSystem& particles, uint island, bool asleep
+) {
+    auto positions = particles.positions();
+    auto velocities = particles.velocities();
+    auto locks = particles.locks();
+    glm::vec3 min(std::numeric_limits<float>::max());
+    glm::vec3 max(std::numeric_limits<float>::lowest());
+    for (std::size_t i = 0; i < particles.size(); ++i) {
+        if (_islands[i] != island)
+            continue;
+        if (asleep) {
+            locks[i] |= LOCK_ASLEEP;
+            velocities[i] = {};
+            min = glm::min(min, pointToVec(positions[i]));
+            max = glm::max(max, pointToVec(positions[i]));
+        } else {
+            locks[i] &= ~LOCK_ASLEEP;
+        }
+    }
+    _min[island] = min;
+    _max[island] = max;
+    _fields[island] = _field;
+    _asleep[island] = asleep;
+    _calm[island] = 0.f;
+    if (asleep)
+        _awake -= _sizes[island];
+    else
+        _awake += _sizes[island];
+}
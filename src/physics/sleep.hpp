@@ -0,0 +1,66 @@
+#pragma once
+
+#include "ParticleSystem.hpp"
+#include "constants.hpp"
+#include "density.hpp"
+#include "links.hpp"
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <span>
+#include <vector>
+
+// Puts the islands of particles at rest to sleep.
+// An island is a set of particles connected by springs. It falls asleep once
+// the kinetic energy of each of its particles has stayed under `energy` for
+// `delay` seconds. Its particles are then locked with LOCK_ASLEEP, so that
+// every solver holds them in place, and the simulation skips the whole step
+// while every island sleeps.
+// A wind that keeps changing keeps the islands moving, so they only sleep
+// under a weak or no wind.
+class SleepTracker {
+public:
+    bool enabled = true;
+    float energy = SLEEP_ENERGY; // Kinetic energy per unit mass
+    float delay = SLEEP_DELAY;   // Seconds of calm before falling asleep
+    float drift = SLEEP_DRIFT;   // Change of the uniform field that wakes
+
+    // Groups the particles connected by the links, all awake
+    void build(std::span<const SpringLink> links, std::size_t count);
+    // Follows ParticleSystem::permute
+    void permute(std::span<const unsigned int> order);
+
+    // Adds deltaTime to the calm time of the islands whose particles all
+    // move slowly enough, and puts those calm for long enough to sleep
+    void update(ParticleSystem& particles, float deltaTime);
+    // Wakes the sleeping islands that an awake particle of another island
+    // has come within the lookup radius of
+    void wakeTouched(ParticleSystem& particles, const Density& density);
+    // Wakes the sleeping islands for which the uniform acceleration, gravity
+    // and wind, has drifted by more than `drift` since they fell asleep.
+    // The islands falling asleep then record this one.
+    void wakeDrifted(ParticleSystem& particles, const glm::vec3& field);
+    // Wakes the island of the particle `index`
+    void wake(ParticleSystem& particles, std::size_t index);
+    // Wakes every island
+    void wake(ParticleSystem& particles);
+
+    std::size_t awake() const { return _awake; }
+    bool asleep() const { return _awake == 0 && !_islands.empty(); }
+
+private:
+    using uint = unsigned int;
+    std::vector<uint> _islands; // Island of each particle
+    std::vector<uint> _sizes;
+    std::vector<float> _calm; // Seconds each island has been calm
+    std::vector<std::uint8_t> _asleep;
+    // Bounds of the sleeping islands, and the field they fell asleep under
+    std::vector<glm::vec3> _min;
+    std::vector<glm::vec3> _max;
+    std::vector<glm::vec3> _fields;
+    glm::vec3 _field {0.f};
+    std::size_t _awake = 0;
+    std::vector<uint> _sleeping;
+
+    void _setAsleep(ParticleSystem& particles, uint island, bool asleep);
+};
@@ -0,0 +1,280 @@
+#include "springs.hpp"
+#include "utils/parallel.hpp"
+#include <algorithm>
+
+void SpringAdjacency::build(
+    const std::vector<SpringLink>& links, std::size_t particleCount,
+    float stiffness, float viscosity
+) {
+    _rowStart.assign(particleCount + 1, 0);
+    for (const auto& link : links) {
+        ++_rowStart[link.a + 1];
+        ++_rowStart[link.b + 1];
+    }
+    for (std::size_t i = 0; i < particleCount; ++i) {
+        _rowStart[i + 1] += _rowStart[i];
+    }
+
+    auto entries = _rowStart.back();
+    _others.resize(entries);
+    _lengths.resize(entries);
+    std::vector<uint> cursor(_rowStart.begin(), _rowStart.end() - 1);
+    for (const auto& link : links) {
+        auto slotA = cursor[link.a]++;
+        _others[slotA] = link.b;
+        _lengths[slotA] = link.length;
+        auto slotB = cursor[link.b]++;
+        _others[slotB] = link.a;
+        _lengths[slotB] = link.length;
+    }
+    setMaterial(stiffness, viscosity);
+}
+
+void SpringAdjacency::setMaterial(float stiffness, float viscosity) {
+    _stiffnesses.assign(_others.size(), stiffness);
+    _viscosities.assign(_others.size(), viscosity);
+}
+
+void SpringAdjacency::prepareForces(ParticleSystem& particles) const {
+    auto positions = particles.positions();
+    auto velocities = particles.velocities();
+    auto forces = particles.forces();
+    auto inverseMasses = particles.inverseMasses();
+    auto locks = particles.locks();
+
+    // The static and sleeping particles drop their forces anyway
+    auto first = particles.staticCount();
+    auto count = particleCount() - first;
+    parallelChunks("Springs chunk", count, [&](auto begin, auto end) {
+        for (auto i = first + begin; i < first + end; ++i) {
+            if (locks[i])
+                continue;
+            kln::translator force {};
+            for (auto e = _rowStart[i]; e < _rowStart[i + 1]; ++e) {
+                auto j = _others[e];
+                force += springForce(
+                    positions[i], positions[j], velocities[i], velocities[j],
+                    _lengths[e], _stiffnesses[e], _viscosities[e]
+                );
+            }
+            forces[i] += force * inverseMasses[i];
+        }
+    });
+}
+
+//============================================================================//
+
+#if defined(__SSE__) || defined(_M_X64)
+#define PHYSIM_SPRING_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+
+#ifdef PHYSIM_SPRING_SIMD
+
+// Klein stores a point as (e123, e032, e013, e021), and a translator as
+// (e0123, e01, e02, e03), in one SSE register each. Transposing the registers
+// of several entities gives one register per component, with one entity per
+// lane.
+
+struct Lanes4 {
+    using Reg = __m128;
+    static constexpr std::size_t width = 4;
+
+    static Reg zero() { return _mm_setzero_ps(); }
+    static Reg set1(float v) { return _mm_set1_ps(v); }
+    static Reg load(const float* v) { return _mm_load_ps(v); }
+    static Reg add(Reg a, Reg b) { return _mm_add_ps(a, b); }
+    static Reg sub(Reg a, Reg b) { return _mm_sub_ps(a, b); }
+    static Reg mul(Reg a, Reg b) { return _mm_mul_ps(a, b); }
+    static Reg div(Reg a, Reg b) { return _mm_div_ps(a, b); }
+    static Reg sqrt(Reg a) { return _mm_sqrt_ps(a); }
+    // Keeps the lanes of `a` where `mask` is not zero
+    static Reg select(Reg mask, Reg a) {
+        return _mm_and_ps(_mm_cmpneq_ps(mask, zero()), a);
+    }
+
+    static void transpose(const __m128* const* in, Reg* out) {
+        out[0] = *in[0];
+        out[1] = *in[1];
+        out[2] = *in[2];
+        out[3] = *in[3];
+        _MM_TRANSPOSE4_PS(out[0], out[1], out[2], out[3]);
+    }
+    static void untranspose(const Reg* in, __m128* out) {
+        out[0] = in[0];
+        out[1] = in[1];
+        out[2] = in[2];
+        out[3] = in[3];
+        _MM_TRANSPOSE4_PS(out[0], out[1], out[2], out[3]);
+    }
+};
+
+#ifdef __AVX2__
+struct Lanes8 {
+    using Reg = __m256;
+    static constexpr std::size_t width = 8;
+
+    static Reg zero() { return _mm256_setzero_ps(); }
+    static Reg set1(float v) { return _mm256_set1_ps(v); }
+    static Reg load(const float* v) { return _mm256_load_ps(v); }
+    static Reg add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+    static Reg sub(Reg a, Reg b) { return _mm256_sub_ps(a, b); }
+    static Reg mul(Reg a, Reg b) { return _mm256_mul_ps(a, b); }
+    static Reg div(Reg a, Reg b) { return _mm256_div_ps(a, b); }
+    static Reg sqrt(Reg a) { return _mm256_sqrt_ps(a); }
+    static Reg select(Reg mask, Reg a) {
+        return _mm256_and_ps(_mm256_cmp_ps(mask, zero(), _CMP_NEQ_OQ), a);
+    }
+
+    static void transpose(const __m128* const* in, Reg* out) {
+        __m128 lo[4];
+        __m128 hi[4];
+        Lanes4::transpose(in, lo);
+        Lanes4::transpose(in + 4, hi);
+        for (int c = 0; c < 4; ++c) {
+            out[c] = _mm256_set_m128(hi[c], lo[c]);
+        }
+    }
+    static void untranspose(const Reg* in, __m128* out) {
+        __m128 lo[4];
+        __m128 hi[4];
+        for (int c = 0; c < 4; ++c) {
+            lo[c] = _mm256_castps256_ps128(in[c]);
+            hi[c] = _mm256_extractf128_ps(in[c], 1);
+        }
+        Lanes4::untranspose(lo, out);
+        Lanes4::untranspose(hi, out + 4);
+    }
+};
+using SpringLanes = Lanes8;
+#else
+using SpringLanes = Lanes4;
+#endif
+
+template <typename L>
+void prepareSpringLanes(
+    ParticleSystem& particles, const SpringLink* links, float stiffness,
+    float viscosity
+) {
+    using Reg = typename L::Reg;
+    constexpr auto W = L::width;
+    auto positions = particles.positions();
+    auto velocities = particles.velocities();
+    auto forces = particles.forces();
+    auto inverseMasses = particles.inverseMasses();
+
+    const __m128* pa[W];
+    const __m128* pb[W];
+    const __m128* va[W];
+    const __m128* vb[W];
+    kln::translator velocityA[W];
+    kln::translator velocityB[W];
+    alignas(32) float lengths[W];
+    alignas(32) float inverseMassA[W];
+    alignas(32) float inverseMassB[W];
+    for (std::size_t l = 0; l < W; ++l) {
+        const auto& link = links[l];
+        pa[l] = &positions[link.a].p3_;
+        pb[l] = &positions[link.b].p3_;
+        velocityA[l] = velocities[link.a];
+        velocityB[l] = velocities[link.b];
+        va[l] = &velocityA[l].p2_;
+        vb[l] = &velocityB[l].p2_;
+        lengths[l] = link.length;
+        inverseMassA[l] = inverseMasses[link.a];
+        inverseMassB[l] = -inverseMasses[link.b];
+    }
+
+    Reg A[4], B[4], VA[4], VB[4];
+    L::transpose(pa, A);
+    L::transpose(pb, B);
+    L::transpose(va, VA);
+    L::transpose(vb, VB);
+
+    Reg delta[3];
+    for (int c = 0; c < 3; ++c) {
+        delta[c] = L::sub(B[c + 1], A[c + 1]);
+    }
+    auto d = L::sqrt(L::add(
+        L::add(L::mul(delta[0], delta[0]), L::mul(delta[1], delta[1])),
+        L::mul(delta[2], delta[2])
+    ));
+    // Same as kln::translator(k * (1 - l0 / d), dir), whose components are
+    // -delta / 2 along the normalized direction
+    auto elastic = L::mul(
+        L::set1(stiffness), L::sub(L::set1(1.f), L::div(L::load(lengths), d))
+    );
+    auto factor = L::div(L::mul(L::set1(-0.5f), elastic), d);
+    auto c = L::set1(viscosity);
+
+    Reg FA[4], FB[4];
+    FA[0] = FB[0] = L::zero();
+    for (int k = 1; k < 4; ++k) {
+        auto F = L::add(
+            L::mul(factor, delta[k - 1]), L::mul(c, L::sub(VB[k], VA[k]))
+        );
+        F = L::select(d, F); // No force between merged particles
+        FA[k] = L::mul(F, L::load(inverseMassA));
+        FB[k] = L::mul(F, L::load(inverseMassB));
+    }
+
+    __m128 outA[W];
+    __m128 outB[W];
+    L::untranspose(FA, outA);
+    L::untranspose(FB, outB);
+    kln::translator fa, fb;
+    for (std::size_t l = 0; l < W; ++l) {
+        fa.p2_ = outA[l];
+        fb.p2_ = outB[l];
+        forces[links[l].a] += fa;
+        forces[links[l].b] += fb;
+    }
+}
+
+#endif
+
+void prepareSpringScalar(
+    ParticleSystem& particles, const SpringLink& link, float stiffness,
+    float viscosity
+) {
+    auto positions = particles.positions();
+    auto velocities = particles.velocities();
+    auto F = springForce(
+        positions[link.a], positions[link.b], velocities[link.a],
+        velocities[link.b], link.length, stiffness, viscosity
+    );
+    auto forces = particles.forces();
+    auto inverseMasses = particles.inverseMasses();
+    forces[link.a] += F * inverseMasses[link.a];
+    forces[link.b] += F * -inverseMasses[link.b];
+}
+
+} // namespace
+
+#ifdef PHYSIM_SPRING_SIMD
+const std::size_t SPRING_LANES = SpringLanes::width;
+#else
+const std::size_t SPRING_LANES = 1;
+#endif
+
+void prepareSpringBatch(
+    ParticleSystem& particles, std::span<const SpringLink> links,
+    float stiffness, float viscosity
+) {
+    auto groups = links.size() / SPRING_LANES;
+    parallelFor(groups, [&](std::size_t g) {
+#ifdef PHYSIM_SPRING_SIMD
+        prepareSpringLanes<SpringLanes>(
+            particles, links.data() + g * SPRING_LANES, stiffness, viscosity
+        );
+#else
+        prepareSpringScalar(particles, links[g], stiffness, viscosity);
+#endif
+    });
+    // Remaining links that do not fill a whole register
+    for (auto i = groups * SPRING_LANES; i < links.size(); ++i) {
+        prepareSpringScalar(particles, links[i], stiffness, viscosity);
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "ParticleSystem.hpp"
+#include "links.hpp"
+
+#include <span>
+#include <string>
+#include <vector>
+
+enum class SpringMode {
+    ColorBatches, // Each link pushes its force onto both of its particles
+    Gather,       // Each particle pulls the forces of its own links
+    SimdBatches,  // Color batches, several links per SIMD instruction
+};
+inline std::string to_string(SpringMode mode) {
+    switch (mode) {
+    case SpringMode::ColorBatches: return "Color batches";
+    case SpringMode::Gather: return "Gather";
+    case SpringMode::SimdBatches: return "SIMD batches";
+    }
+    return "Unknown";
+}
+const auto spring_modes = {
+    SpringMode::ColorBatches,
+    SpringMode::Gather,
+    SpringMode::SimdBatches,
+};
+
+// Number of links evaluated at once by prepareSpringBatch
+extern const std::size_t SPRING_LANES;
+
+// Accumulates the forces of a batch of links that share no particle.
+// The links are evaluated SPRING_LANES at a time, in SIMD registers.
+void prepareSpringBatch(
+    ParticleSystem& particles, std::span<const SpringLink> links,
+    float stiffness, float viscosity
+);
+
+// Compressed sparse row adjacency of the spring links.
+// Every link is stored once per particle it connects, along with its own rest
+// length, stiffness and viscosity.
+class SpringAdjacency {
+public:
+    SpringAdjacency() = default;
+
+    void build(
+        const std::vector<SpringLink>& links, std::size_t particleCount,
+        float stiffness, float viscosity
+    );
+    // Sets the same material on every link
+    void setMaterial(float stiffness, float viscosity);
+
+    // Accumulates the spring forces of each particle, one particle per task
+    void prepareForces(ParticleSystem& particles) const;
+
+    std::size_t particleCount() const {
+        return _rowStart.empty() ? 0 : _rowStart.size() - 1;
+    }
+
+    std::span<const unsigned int> rowStart() const { return _rowStart; }
+    std::span<const unsigned int> others() const { return _others; }
+    std::span<const float> lengths() const { return _lengths; }
+    std::span<const float> stiffnesses() const { return _stiffnesses; }
+    std::span<const float> viscosities() const { return _viscosities; }
+
+private:
+    using uint = unsigned int;
+
+    // The links of the particle i are [_rowStart[i], _rowStart[i + 1])
+    std::vector<uint> _rowStart;
+    std::vector<uint> _others;
+    std::vector<float> _lengths;
+    std::vector<float> _stiffnesses;
+    std::vector<float> _viscosities;
+};
@@ -0,0 +1,133 @@
+#include "xpbd.hpp"
+#include "utils/parallel.hpp"
+#include "utils/types.hpp"
+
+// Multiplier change of the constraint |x2 - x1| = length.
+// Returns the unit direction from x1 to x2 in `direction`.
+static float projectDistance(
+    const glm::vec3& x1, const glm::vec3& x2, float w1, float w2,
+    float length, float compliance, float lambda, glm::vec3& direction
+) {
+    auto delta = x2 - x1;
+    auto d = glm::length(delta);
+    auto w = w1 + w2 + compliance;
+    if (d == 0 || w == 0)
+        return 0;
+    direction = delta / d;
+    return (length - d - compliance * lambda) / w;
+}
+
+void PositionSolver::begin(const ParticleSystem& particles) {
+    auto positions = particles.positions();
+    _previous.resize(particles.size());
+    parallelFor(positions.size(), [&](std::size_t i) {
+        _previous[i] = pointToVec(positions[i]);
+    });
+}
+
+void PositionSolver::solve(
+    ParticleSystem& particles, std::span<const SpringLink> links,
+    std::span<const std::size_t> linkBatches,
+    const SpringAdjacency& adjacency, float stiffness, float deltaTime
+) {
+    auto positions = particles.positions();
+    auto velocities = particles.velocities();
+    auto inverseMasses = particles.inverseMasses();
+    auto locks = particles.locks();
+    auto count = particles.size();
+
+    _positions.resize(count);
+    _weights.resize(count);
+    parallelFor(count, [&](std::size_t i) {
+        _positions[i] = pointToVec(positions[i]);
+        _weights[i] = locks[i] ? 0.f : inverseMasses[i];
+    });
+
+    if (mode == Mode::GaussSeidel)
+        _solveGaussSeidel(links, linkBatches, stiffness, deltaTime);
+    else
+        _solveJacobi(adjacency, deltaTime);
+
+    parallelFor(count, [&](std::size_t i) {
+        if (locks[i])
+            return;
+        positions[i] = vecToPoint(_positions[i]);
+        velocities[i] =
+            vecToTranslator((_positions[i] - _previous[i]) / deltaTime);
+    });
+}
+
+void PositionSolver::_solveGaussSeidel(
+    std::span<const SpringLink> links,
+    std::span<const std::size_t> linkBatches, float stiffness, float deltaTime
+) {
+    auto scale = 1.f / (stiffness * deltaTime * deltaTime);
+    _lambdas.assign(links.size(), 0.f);
+
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        // The links of a batch share no particle
+        for (std::size_t b = 0; b + 1 < linkBatches.size(); ++b) {
+            auto first = linkBatches[b];
+            parallelFor(linkBatches[b + 1] - first, [&](std::size_t k) {
+                auto l = first + k;
+                const auto& link = links[l];
+                auto& x1 = _positions[link.a];
+                auto& x2 = _positions[link.b];
+                auto w1 = _weights[link.a];
+                auto w2 = _weights[link.b];
+                glm::vec3 n;
+                auto dLambda = projectDistance(
+                    x1, x2, w1, w2, link.length, link.length * scale,
+                    _lambdas[l], n
+                );
+                _lambdas[l] += dLambda;
+                x1 -= n * (w1 * dLambda);
+                x2 += n * (w2 * dLambda);
+            });
+        }
+    }
+}
+
+void PositionSolver::_solveJacobi(
+    const SpringAdjacency& adjacency, float deltaTime
+) {
+    auto rowStart = adjacency.rowStart();
+    auto others = adjacency.others();
+    auto lengths = adjacency.lengths();
+    auto stiffnesses = adjacency.stiffnesses();
+    auto scale = 1.f / (deltaTime * deltaTime);
+
+    // Each side of a link keeps the multiplier of the corrections it applied
+    _lambdas.assign(others.size(), 0.f);
+    _corrections.resize(_positions.size());
+
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        parallelFor(_positions.size(), [&](std::size_t i) {
+            auto begin = rowStart[i];
+            auto end = rowStart[i + 1];
+            glm::vec3 correction(0.f);
+            if (_weights[i] == 0 || begin == end) {
+                _corrections[i] = correction;
+                return;
+            }
+            // Averaged over the constraints of the particle
+            auto factor = XPBD_JACOBI_RELAXATION / float(end - begin);
+            for (auto e = begin; e < end; ++e) {
+                auto j = others[e];
+                auto compliance = lengths[e] * scale / stiffnesses[e];
+                glm::vec3 n;
+                auto dLambda = projectDistance(
+                    _positions[i], _positions[j], _weights[i],
+                    _weights[j], lengths[e], compliance, _lambdas[e], n
+                );
+                dLambda *= factor;
+                _lambdas[e] += dLambda;
+                correction -= n * (_weights[i] * dLambda);
+            }
+            _corrections[i] = correction;
+        });
+        parallelFor(_positions.size(), [&](std::size_t i) {
+            _positions[i] += _corrections[i];
+        });
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "ParticleSystem.hpp"
+#include "constants.hpp"
+#include "links.hpp"
+#include "springs.hpp"
+
+#include <glm/glm.hpp>
+#include <span>
+#include <string>
+#include <vector>
+
+// Extended position based dynamics.
+// Each spring is a distance constraint, with a compliance of length /
+// stiffness, so that it rests where the explicit spring would. The particles
+// are first moved by the other forces, then projected on the constraints, and
+// their velocities are deduced from how far they moved.
+class PositionSolver {
+public:
+    enum class Mode {
+        GaussSeidel, // One color batch after the other
+        Jacobi,      // Every constraint at once, from the spring adjacency
+    };
+
+    Mode mode = Mode::GaussSeidel;
+    int iterations = XPBD_ITERATIONS;
+
+    // Remembers where the particles start the step from
+    void begin(const ParticleSystem& particles);
+
+    // Projects the integrated particles on the springs, and updates their
+    // velocities. The links must be sorted by colors, as by colorLinks.
+    void solve(
+        ParticleSystem& particles, std::span<const SpringLink> links,
+        std::span<const std::size_t> linkBatches,
+        const SpringAdjacency& adjacency, float stiffness, float deltaTime
+    );
+
+private:
+    std::vector<glm::vec3> _previous;
+    std::vector<glm::vec3> _positions;
+    std::vector<glm::vec3> _corrections;
+    std::vector<float> _weights;
+    // One multiplier per link, or per adjacency entry in Jacobi mode
+    std::vector<float> _lambdas;
+
+    void _solveGaussSeidel(
+        std::span<const SpringLink> links,
+        std::span<const std::size_t> linkBatches, float stiffness,
+        float deltaTime
+    );
+    void _solveJacobi(const SpringAdjacency& adjacency, float deltaTime);
+};
+
+inline std::string to_string(PositionSolver::Mode mode) {
+    switch (mode) {
+    case PositionSolver::Mode::GaussSeidel: return "Gauss-Seidel";
+    case PositionSolver::Mode::Jacobi: return "Jacobi";
+    }
+    return "Unknown";
+}
+const auto position_solver_modes = {
+    PositionSolver::Mode::GaussSeidel,
+    PositionSolver::Mode::Jacobi,
+};
@@ -1,4 +1,5 @@
 #include "Displayator.hpp"
+#include "../utils/parallel.hpp"
 #include "../utils/types.hpp"
 #include "gl/helper.hpp"
 #include "glm/ext/matrix_clip_space.hpp"
@@ -7,7 +8,6 @@
 #include "klein/point.hpp"
 #include "klein/translator.hpp"
 #include <cassert>
-#include <execution>
 
 Shader& basicFrag() {
     static auto shader = loadShader(GL_FRAGMENT_SHADER, "res/basic.frag");
@@ -129,13 +129,9 @@ Displayator& Displayator::drawPoints(const std::vector<glm::vec3>& positions) {
         .setUniform("projection", _projection);
     _quadMesh.bind();
     std::vector<Instance> instances(positions.size());
-    std::transform(
-        std::execution::par_unseq, positions.begin(), positions.end(),
-        instances.begin(),
-        [](const glm::vec3& position) {
-            return Instance {position, glm::vec3(0.0f)};
-        }
-    );
+    parallelFor(positions.size(), [&](std::size_t i) {
+        instances[i] = Instance {positions[i], glm::vec3(0.0f)};
+    });
     _quadMesh.drawInstanced(instances);
     _quadMesh.unbind();
     return *this;
@@ -151,13 +147,9 @@ Displayator& Displayator::drawLines(
         .setUniform("projection", _projection);
     _quadMesh.bind();
     std::vector<Instance> instances(starts.size());
-    std::transform(
-        std::execution::par_unseq, starts.begin(), starts.end(), ends.begin(),
-        instances.begin(),
-        [](const glm::vec3& start, const glm::vec3& end) {
-            return Instance {start, end};
-        }
-    );
+    parallelFor(starts.size(), [&](std::size_t i) {
+        instances[i] = Instance {starts[i], ends[i]};
+    });
     _quadMesh.drawInstanced(instances);
     _quadMesh.unbind();
     return *this;
@@ -173,13 +165,9 @@ Displayator& Displayator::drawLines(
         .setUniform("projection", _projection);
     _quadMesh.bind();
     std::vector<Instance> instances(lines.size());
-    std::transform(
-        std::execution::par_unseq, lines.begin(), lines.end(),
-        instances.begin(),
-        [](const std::pair<glm::vec3, glm::vec3>& line) {
-            return Instance {line.first, line.second};
-        }
-    );
+    parallelFor(lines.size(), [&](std::size_t i) {
+        instances[i] = Instance {lines[i].first, lines[i].second};
+    });
     _quadMesh.drawInstanced(instances);
     _quadMesh.unbind();
     return *this;
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdio>
+
+// Failed checks of the test so far
+inline int checkFailures = 0;
+
+// Reports the condition when it's false, and carries on with the test
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            std::fprintf(                                                      \
+                stderr, "%s:%d: failed %s\n", __FILE__, __LINE__, #condition   \
+            );                                                                 \
+            ++checkFailures;                                                   \
+        }                                                                      \
+    } while (false)
+
+// Exit code of the test
+inline int checkResult() {
+    if (checkFailures > 0)
+        std::fprintf(stderr, "%d failed checks\n", checkFailures);
+    return checkFailures > 0 ? 1 : 0;
+}
@@ -0,0 +1,87 @@
+// CompactTranslator against kln::translator, on the operations the particle
+// passes use. Both do the same float operations on e01, e02 and e03, so the
+// results must match exactly.
+#include "check.hpp"
+#include "physics/compact.hpp"
+#include "utils/types.hpp"
+
+#include <array>
+#include <klein/klein.hpp>
+
+static const std::array<kln::translator, 4> translators = {
+    kln::translator(1.5f, 1.f, 0.f, 0.f),
+    kln::translator(0.3f, 1.f, 2.f, -3.f),
+    kln::translator(-2.f, 0.f, 0.f, 1.f),
+    vecToTranslator({1e-3f, -4.f, 7.5f}),
+};
+static const std::array<kln::point, 3> points = {
+    kln::point(0.f, 0.f, 0.f),
+    kln::point(1.f, -2.f, 3.f),
+    kln::point(-15.f, 0.25f, 8.f),
+};
+
+static bool same(const CompactTranslator& compact, const kln::translator& t) {
+    kln::translator back = compact;
+    return compact.e01() == t.e01() && compact.e02() == t.e02() &&
+           compact.e03() == t.e03() && back.e01() == t.e01() &&
+           back.e02() == t.e02() && back.e03() == t.e03() &&
+           back.e0123() == 0.f;
+}
+
+static bool same(const kln::point& a, const kln::point& b) {
+    return a.e013() == b.e013() && a.e021() == b.e021() &&
+           a.e032() == b.e032() && a.e123() == b.e123();
+}
+
+static void testConstruction() {
+    CHECK(same(CompactTranslator(), kln::translator()));
+    for (const auto& t : translators) {
+        CHECK(same(CompactTranslator(t), t));
+    }
+}
+
+static void testArithmetic() {
+    for (const auto& a : translators) {
+        for (const auto& b : translators) {
+            CompactTranslator ca = a, cb = b;
+            CHECK(same(ca + cb, a + b));
+            CHECK(same(ca - cb, a - b));
+
+            auto sum = ca;
+            sum += cb;
+            auto expected = a;
+            expected += b;
+            CHECK(same(sum, expected));
+        }
+        for (float s : {0.f, 1.f, -0.5f, 1.f / 60.f, 1e4f}) {
+            CompactTranslator ca = a;
+            CHECK(same(ca * s, a * s));
+            CHECK(same(s * ca, s * a));
+            ca *= s;
+            CHECK(same(ca, a * s));
+        }
+    }
+}
+
+static void testTranslatorToVec() {
+    for (const auto& t : translators) {
+        CHECK(translatorToVec(CompactTranslator(t)) == translatorToVec(t));
+    }
+}
+
+static void testApply() {
+    for (const auto& t : translators) {
+        CompactTranslator compact = t;
+        for (const auto& p : points) {
+            CHECK(same(compact(p), t(p)));
+        }
+    }
+}
+
+int main() {
+    testConstruction();
+    testArithmetic();
+    testTranslatorToVec();
+    testApply();
+    return checkResult();
+}
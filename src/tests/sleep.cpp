@@ -0,0 +1,116 @@
+// SleepTracker on three islands of two particles, 10 units apart along x:
+// falling asleep, waking by index, by contact and by a drifting field.
+#include "check.hpp"
+#include "physics/ParticleSystem.hpp"
+#include "physics/density.hpp"
+#include "physics/sleep.hpp"
+
+#include <array>
+#include <klein/klein.hpp>
+
+struct Scene {
+    ParticleSystem particles;
+    SleepTracker sleep;
+    Density density;
+
+    Scene() {
+        std::array<SpringLink, 3> links;
+        for (int k = 0; k < 3; ++k) {
+            particles.emplace_back(kln::point(10.f * k, 0.f, 0.f));
+            particles.emplace_back(kln::point(10.f * k + 1.f, 0.f, 0.f));
+            links[k] = {2 * k, 2 * k + 1, 1.f};
+        }
+        sleep.build(links, particles.size());
+        density.setParticles(particles);
+    }
+
+    bool asleep(std::size_t index) {
+        return particles.locks()[index] & LOCK_ASLEEP;
+    }
+};
+
+static void testFallAsleep() {
+    Scene scene;
+    // The middle island keeps moving
+    scene.particles.velocities()[2] = kln::translator(1.f, 1.f, 0.f, 0.f);
+
+    scene.sleep.update(scene.particles, scene.sleep.delay / 2);
+    CHECK(scene.sleep.awake() == 6);
+    scene.sleep.update(scene.particles, scene.sleep.delay / 2);
+    CHECK(scene.sleep.awake() == 2);
+    CHECK(!scene.sleep.asleep());
+    CHECK(scene.asleep(0) && scene.asleep(1));
+    CHECK(!scene.asleep(2) && !scene.asleep(3));
+    CHECK(scene.asleep(4) && scene.asleep(5));
+
+    scene.particles.velocities()[2] = {};
+    scene.sleep.update(scene.particles, scene.sleep.delay);
+    CHECK(scene.sleep.awake() == 0);
+    CHECK(scene.sleep.asleep());
+
+    // Disabled, nothing falls asleep
+    Scene disabled;
+    disabled.sleep.enabled = false;
+    disabled.sleep.update(disabled.particles, disabled.sleep.delay);
+    CHECK(disabled.sleep.awake() == 6);
+}
+
+static void testWake() {
+    Scene scene;
+    scene.sleep.update(scene.particles, scene.sleep.delay);
+    CHECK(scene.sleep.asleep());
+
+    scene.sleep.wake(scene.particles, 3);
+    CHECK(scene.sleep.awake() == 2);
+    CHECK(!scene.asleep(2) && !scene.asleep(3));
+    CHECK(scene.asleep(0) && scene.asleep(4));
+
+    scene.sleep.wake(scene.particles);
+    CHECK(scene.sleep.awake() == 6);
+    for (std::size_t i = 0; i < scene.particles.size(); ++i) {
+        CHECK(!scene.asleep(i));
+    }
+}
+
+static void testWakeTouched() {
+    Scene scene;
+    scene.sleep.update(scene.particles, scene.sleep.delay);
+    scene.sleep.wake(scene.particles, 4);
+
+    // Still out of reach of the others
+    scene.density.update();
+    scene.sleep.wakeTouched(scene.particles, scene.density);
+    CHECK(scene.sleep.awake() == 2);
+
+    // The last island comes within the lookup radius of the middle one only
+    auto reach = scene.density.lookupRadius / 2;
+    scene.particles.positions()[4] = kln::point(11.f + reach, 0.f, 0.f);
+    scene.density.update();
+    scene.sleep.wakeTouched(scene.particles, scene.density);
+    CHECK(scene.sleep.awake() == 4);
+    CHECK(!scene.asleep(2) && !scene.asleep(3));
+    CHECK(scene.asleep(0) && scene.asleep(1));
+}
+
+static void testWakeDrifted() {
+    Scene scene;
+    glm::vec3 field(0.f, -9.8f, 0.f);
+    scene.sleep.wakeDrifted(scene.particles, field);
+    scene.sleep.update(scene.particles, scene.sleep.delay);
+    CHECK(scene.sleep.asleep());
+
+    // Measured from the field they fell asleep under, not the last one
+    auto step = glm::vec3(scene.sleep.drift * .75f, 0.f, 0.f);
+    scene.sleep.wakeDrifted(scene.particles, field + step);
+    CHECK(scene.sleep.asleep());
+    scene.sleep.wakeDrifted(scene.particles, field + 2.f * step);
+    CHECK(scene.sleep.awake() == 6);
+}
+
+int main() {
+    testFallAsleep();
+    testWake();
+    testWakeTouched();
+    testWakeDrifted();
+    return checkResult();
+}
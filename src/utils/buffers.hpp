@@ -0,0 +1,48 @@
+#pragma once
+
+#include "memory.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Hands complete values from one writer thread to one reader thread, without
+// locks. The writer fills the back slot and publishes it, the reader fetches
+// the latest published slot. Neither ever waits for the other: the third slot
+// holds the latest value while both are busy.
+template <typename T>
+class TripleBuffer {
+public:
+    // Slot being written, owned by the writer
+    T& back() { return _slots[_back].value; }
+    // Swaps the back slot with the shared one, and marks it as fresh
+    void publish() {
+        _back = _shared.exchange(_back | FRESH, std::memory_order_acq_rel) &
+                INDEX;
+    }
+
+    // Takes the shared slot if something was published since the last fetch.
+    // Returns whether front() changed.
+    bool fetch() {
+        if (!(_shared.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        _front = _shared.exchange(_front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+    // Slot being read, owned by the reader
+    const T& front() const { return _slots[_front].value; }
+
+private:
+    static constexpr std::uint8_t INDEX = 0b011;
+    static constexpr std::uint8_t FRESH = 0b100;
+
+    // One cache line per slot, so the threads do not share any line
+    struct alignas(CACHE_LINE) Slot {
+        T value;
+    };
+    std::array<Slot, 3> _slots {};
+
+    alignas(CACHE_LINE) std::uint8_t _back = 0;
+    alignas(CACHE_LINE) std::uint8_t _front = 1;
+    alignas(CACHE_LINE) std::atomic<std::uint8_t> _shared = 2;
+};
@@ -1,10 +1,13 @@
+#include <bit>
+#include <cstdint>
 #include <ranges>
+#include <stdexcept>
 
 #include "constants.hpp"
 #include "creators.hpp"
 
 void drape(
-    std::vector<Particle>& particles, std::vector<SpringLink>& links,
+    ParticleSystem& particles, std::vector<SpringLink>& links,
     const DrapeParameters& params
 ) {
     auto [nextCount, mass, knot, anchors, direction] = params;
@@ -65,7 +68,7 @@ void drape(
             case DrapeAnchors::Edges:
                 if (i == 0 || i == nextCount - 1 || j == 0 ||
                     j == nextCount - 1) {
-                    particles.back().lock = true;
+                    particles.back().lock = LOCK_PINNED;
                 }
                 break;
             case DrapeAnchors::Corners:
@@ -73,37 +76,74 @@ void drape(
                     (i == nextCount - 1 && j == nextCount - 1) ||
                     (i == 0 && j == nextCount - 1) ||
                     (i == nextCount - 1 && j == 0)) {
-                    particles.back().lock = true;
+                    particles.back().lock = LOCK_PINNED;
                 }
                 break;
             case DrapeAnchors::Center:
                 if (i == nextCount / 2 && j == nextCount / 2) {
-                    particles.back().lock = true;
+                    particles.back().lock = LOCK_PINNED;
                 }
                 break;
             case DrapeAnchors::TwoCorners:
                 if ((i == 0 && j == 0) || (i == 0 && j == nextCount - 1)) {
-                    particles.back().lock = true;
+                    particles.back().lock = LOCK_PINNED;
                 }
                 break;
             case DrapeAnchors::TwoCorners2:
                 if ((i == 0 && j == nextCount - 1) ||
                     (i == nextCount - 1 && j == nextCount - 1)) {
-                    particles.back().lock = true;
+                    particles.back().lock = LOCK_PINNED;
                 }
                 break;
             case DrapeAnchors::OneEdge:
                 if (i == 0) {
-                    particles.back().lock = true;
+                    particles.back().lock = LOCK_PINNED;
                 }
                 break;
             case DrapeAnchors::OneEdge2:
                 if (j == nextCount - 1) {
-                    particles.back().lock = true;
+                    particles.back().lock = LOCK_PINNED;
                 }
                 break;
                 break;
             }
         }
     }
-}
\ No newline at end of file
+}
+
+std::vector<std::size_t> colorLinks(
+    std::vector<SpringLink>& links, std::size_t particleCount
+) {
+    // Greedy coloring: each link takes the first color that none of the other
+    // links of its two particles use yet
+    std::vector<std::uint64_t> usedColors(particleCount, 0);
+    std::vector<int> colors(links.size());
+    int colorCount = 0;
+    for (std::size_t i = 0; i < links.size(); ++i) {
+        auto& link = links[i];
+        auto used = usedColors[link.a] | usedColors[link.b];
+        if (~used == 0)
+            throw std::runtime_error("Too many links on a single particle");
+        auto color = std::countr_one(used);
+        usedColors[link.a] |= std::uint64_t(1) << color;
+        usedColors[link.b] |= std::uint64_t(1) << color;
+        colors[i] = color;
+        colorCount = std::max(colorCount, color + 1);
+    }
+
+    // Stable counting sort of the links by color
+    std::vector<std::size_t> offsets(colorCount + 1, 0);
+    for (auto color : colors) {
+        ++offsets[color + 1];
+    }
+    for (int c = 0; c < colorCount; ++c) {
+        offsets[c + 1] += offsets[c];
+    }
+    std::vector<SpringLink> sorted(links.size());
+    auto cursor = offsets;
+    for (std::size_t i = 0; i < links.size(); ++i) {
+        sorted[cursor[colors[i]]++] = links[i];
+    }
+    links = std::move(sorted);
+    return offsets;
+}
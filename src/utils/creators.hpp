@@ -1,17 +1,12 @@
 #pragma once
 
+#include "physics/ParticleSystem.hpp"
 #include "physics/base.hpp"
 #include "physics/links.hpp"
 #include <glm/glm.hpp>
 #include <string>
 #include <vector>
 
-struct SpringLink {
-    int a;
-    int b;
-    float length;
-};
-
 enum class DrapeAnchors {
     None,
     Corners,
@@ -55,6 +50,13 @@ struct DrapeParameters {
 };
 
 void drape(
-    std::vector<Particle>& particles, std::vector<SpringLink>& links,
+    ParticleSystem& particles, std::vector<SpringLink>& links,
     const DrapeParameters& grid
 );
+
+// Reorders the links into batches in which no two links share a particle,
+// so that each batch can be applied in parallel without any race.
+// Returns the offsets of the batches: batch i is [offsets[i], offsets[i + 1]).
+std::vector<std::size_t> colorLinks(
+    std::vector<SpringLink>& links, std::size_t particleCount
+);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// Cache line size, used to align the particle streams
+constexpr std::size_t CACHE_LINE = 64;
+
+template <typename T, std::size_t Alignment = CACHE_LINE>
+class AlignedAllocator {
+public:
+    static_assert(Alignment >= alignof(T));
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() noexcept = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(
+            ::operator new(n * sizeof(T), std::align_val_t(Alignment))
+        );
+    }
+    void deallocate(T* p, std::size_t) noexcept {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept {
+        return true;
+    }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
@@ -0,0 +1,193 @@
+#include "parallel.hpp"
+#include <string>
+#include <utility>
+
+// Yields of an idle worker before it goes to sleep
+static constexpr int IDLE_SPINS = 64;
+
+// Queue of the worker running on this thread, -1 outside of the pool
+static thread_local int workerIndex = -1;
+
+#ifdef PHYSIM_PROFILING
+// Zone of the loop whose chunks this thread is running. It stays open while
+// the thread takes chunks of the same loop, and closes when the thread moves
+// on to another loop or runs out of chunks.
+struct LoopZone {
+    std::size_t job = 0;
+    int zone = -1;
+    Second start = 0;
+};
+static thread_local LoopZone loopZone;
+#endif
+
+static void leaveLoopZone() {
+#ifdef PHYSIM_PROFILING
+    if (loopZone.zone < 0)
+        return;
+    Profiler::instance().leave(loopZone.zone, loopZone.start);
+    loopZone.zone = -1;
+#endif
+}
+
+static void enterLoopZone(
+    [[maybe_unused]] std::size_t job, [[maybe_unused]] const char* zone
+) {
+#ifdef PHYSIM_PROFILING
+    if (loopZone.zone >= 0 && loopZone.job == job)
+        return;
+    leaveLoopZone();
+    if (zone)
+        loopZone = {job, Profiler::instance().enter(zone), Profiler::now()};
+#endif
+}
+
+// A loop started from a chunk of another keeps the zone of the outer loop
+// open around its own ones, and gives it back when it's done
+struct NestedLoopZone {
+#ifdef PHYSIM_PROFILING
+    LoopZone outer = std::exchange(loopZone, {});
+    ~NestedLoopZone() {
+        leaveLoopZone();
+        loopZone = outer;
+    }
+#endif
+};
+
+ThreadPool& ThreadPool::instance() {
+    static ThreadPool pool(std::thread::hardware_concurrency());
+    return pool;
+}
+
+ThreadPool::ThreadPool(unsigned maxThreads)
+    : _threadCount(std::max(maxThreads, 1u)) {
+    auto workers = _threadCount - 1;
+    for (unsigned i = 0; i < workers; ++i) {
+        _queues.push_back(std::make_unique<Queue>());
+    }
+    for (unsigned i = 0; i < workers; ++i) {
+        _workers.emplace_back([this, i] { _work(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::scoped_lock lock(_sleepMutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (auto& worker : _workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::setThreadCount(unsigned count) {
+    _threadCount = std::clamp(count, 1u, maxThreadCount());
+    std::scoped_lock lock(_sleepMutex);
+    _wake.notify_all();
+}
+
+void ThreadPool::_run(std::size_t count, std::size_t grain, Job& job) {
+    [[maybe_unused]] NestedLoopZone nested;
+    job.id = _nextJob.fetch_add(1, std::memory_order_relaxed);
+    std::size_t threads = _threadCount;
+    if (grain == 0) {
+        grain = std::max(
+            PARALLEL_MIN_GRAIN, count / (threads * PARALLEL_CHUNKS_PER_THREAD)
+        );
+    }
+    auto chunks = (count + grain - 1) / grain;
+    if (threads == 1 || chunks <= 1) {
+        if (count > 0) {
+            enterLoopZone(job.id, job.zone);
+            job.run(job.func, 0, count);
+        }
+        return;
+    }
+
+    // Deal the chunks to the active workers, starting from a different one
+    // each time, so that concurrent loops don't pile up on the first queue
+    job.remaining = chunks;
+    _queued += chunks;
+    auto workers = threads - 1;
+    for (std::size_t c = 0; c < chunks; ++c) {
+        auto& queue = *_queues[(job.id + c) % workers];
+        std::scoped_lock lock(queue.mutex);
+        queue.tasks.push_back(
+            {&job, c * count / chunks, (c + 1) * count / chunks}
+        );
+    }
+    _wakeWorkers();
+
+    // Help until the last chunk is done, wherever it ran
+    while (job.remaining.load(std::memory_order_acquire) > 0) {
+        if (!_runOne(workerIndex))
+            std::this_thread::yield();
+    }
+}
+
+bool ThreadPool::_runOne(int self) {
+    Task task;
+    bool found = false;
+    if (self >= 0) {
+        auto& queue = *_queues[self];
+        std::scoped_lock lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+            found = true;
+        }
+    }
+    for (std::size_t k = 0; !found && k < _queues.size(); ++k) {
+        auto& queue = *_queues[(self + 1 + k) % _queues.size()];
+        std::scoped_lock lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+            found = true;
+        }
+    }
+    if (!found) {
+        leaveLoopZone();
+        return false;
+    }
+
+    --_queued;
+    enterLoopZone(task.job->id, task.job->zone);
+    task.job->run(task.job->func, task.begin, task.end);
+    // The job may be gone as soon as its last chunk is counted
+    task.job->remaining.fetch_sub(1, std::memory_order_acq_rel);
+    return true;
+}
+
+void ThreadPool::_work(unsigned index) {
+    workerIndex = int(index);
+    Profiler::instance().setThreadName("Worker " + std::to_string(index + 1));
+
+    const auto active = [&] { return index + 1 < _threadCount; };
+    while (true) {
+        bool worked = false;
+        for (int spin = 0; spin < IDLE_SPINS && !worked; ++spin) {
+            worked = active() && _queued > 0 && _runOne(int(index));
+            if (!worked) {
+                leaveLoopZone();
+                std::this_thread::yield();
+            }
+        }
+        if (worked)
+            continue;
+
+        std::unique_lock lock(_sleepMutex);
+        ++_sleeping;
+        _wake.wait(lock, [&] { return _stop || (active() && _queued > 0); });
+        --_sleeping;
+        if (_stop)
+            return;
+    }
+}
+
+void ThreadPool::_wakeWorkers() {
+    if (_sleeping == 0)
+        return;
+    std::scoped_lock lock(_sleepMutex);
+    _wake.notify_all();
+}
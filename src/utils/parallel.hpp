@@ -0,0 +1,139 @@
+#pragma once
+
+#include "memory.hpp"
+#include "physics/Profiler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Chunks per thread of a loop, to balance uneven chunks
+constexpr std::size_t PARALLEL_CHUNKS_PER_THREAD = 4;
+// Loops are not split below this many iterations per chunk, so that small
+// loops don't pay for the threads
+constexpr std::size_t PARALLEL_MIN_GRAIN = 64;
+
+// Persistent pool of worker threads, with one task queue each.
+// A loop deals its chunks round-robin to the queues of the active workers.
+// A worker takes its own tasks from the back of its queue, and steals from
+// the front of the others when it runs out. The thread that starts a loop
+// steals too, until every chunk is done.
+class ThreadPool {
+public:
+    static ThreadPool& instance();
+
+    explicit ThreadPool(unsigned maxThreads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Threads that share a loop, the calling one included
+    unsigned threadCount() const { return _threadCount; }
+    unsigned maxThreadCount() const { return _queues.size() + 1; }
+    // Clamped to [1, maxThreadCount()]. The extra workers sleep.
+    void setThreadCount(unsigned count);
+
+    // Runs func(begin, end) over chunks of [0, count), of at least `grain`
+    // iterations each. A grain of 0 picks one from the count and the threads.
+    // With a `zone`, each thread that takes part records one profiler zone
+    // over the consecutive chunks it runs, rather than one per chunk.
+    template <typename Func>
+    void forChunks(
+        std::size_t count, std::size_t grain, Func&& func,
+        const char* zone = nullptr
+    ) {
+        Job job {
+            [](void* f, std::size_t begin, std::size_t end) {
+                (*static_cast<std::remove_reference_t<Func>*>(f))(begin, end);
+            },
+            &func,
+            zone,
+        };
+        _run(count, grain, job);
+    }
+
+private:
+    struct Job {
+        void (*run)(void* func, std::size_t begin, std::size_t end);
+        void* func;
+        const char* zone;
+        // Tells the loops apart, for the zones kept open across chunks
+        std::size_t id = 0;
+        std::atomic<std::size_t> remaining = 0;
+    };
+    struct Task {
+        Job* job;
+        std::size_t begin;
+        std::size_t end;
+    };
+    struct alignas(CACHE_LINE) Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> _queues;
+    std::vector<std::thread> _workers;
+    std::atomic<unsigned> _threadCount;
+    std::atomic<std::size_t> _nextJob = 1;
+    // Tasks pushed and not taken yet, to know when the workers may sleep
+    std::atomic<std::size_t> _queued = 0;
+    std::atomic<unsigned> _sleeping = 0;
+    std::mutex _sleepMutex;
+    std::condition_variable _wake;
+    bool _stop = false;
+
+    void _run(std::size_t count, std::size_t grain, Job& job);
+    bool _runOne(int self);
+    void _work(unsigned index);
+    void _wakeWorkers();
+};
+
+// Runs func(i) for every i of [0, count) on the thread pool
+template <typename Func>
+void parallelFor(std::size_t count, Func&& func, std::size_t grain = 0) {
+    ThreadPool::instance().forChunks(
+        count, grain,
+        [&](std::size_t begin, std::size_t end) {
+            for (auto i = begin; i < end; ++i) {
+                func(i);
+            }
+        }
+    );
+}
+
+// Runs func(begin, end) over contiguous chunks of [0, count) on the thread
+// pool. Each thread records its share of the loop as a profiler zone named
+// `zone`, so the traces show how the workers share it.
+template <typename Func>
+void parallelChunks(
+    const char* zone, std::size_t count, Func&& func, std::size_t grain = 0
+) {
+    ThreadPool::instance().forChunks(count, grain, func, zone);
+}
+
+// Sum of map(i) over [0, count), in no particular order
+template <typename T, typename Map>
+T parallelSum(std::size_t count, T zero, Map&& map) {
+    std::mutex mutex;
+    T sum = zero;
+    ThreadPool::instance().forChunks(
+        count, 0,
+        [&](std::size_t begin, std::size_t end) {
+            T partial = zero;
+            for (auto i = begin; i < end; ++i) {
+                partial += map(i);
+            }
+            std::scoped_lock lock(mutex);
+            sum += partial;
+        }
+    );
+    return sum;
+}
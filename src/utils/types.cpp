@@ -18,3 +18,15 @@ kln::translator pointToTranslator(const kln::point& p) {
     auto res = kln::translator(l, pn.x(), pn.y(), pn.z());
     return res;
 }
+
+glm::vec3 translatorToVec(const kln::translator& t) {
+    // A translator of distance d along the direction n is 1 - d/2 n e0
+    return glm::vec3(t.e01(), t.e02(), t.e03()) * -2.f;
+}
+
+kln::translator vecToTranslator(const glm::vec3& v) {
+    auto l = glm::length(v);
+    if (l == 0)
+        return {};
+    return kln::translator(l, v.x, v.y, v.z);
+}
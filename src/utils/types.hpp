@@ -7,3 +7,7 @@ kln::point vecToPoint(const glm::vec3& v);
 glm::vec3 pointToVec(const kln::point& p);
 
 kln::translator pointToTranslator(const kln::point& p);
+
+// Displacement of a translator, and back
+glm::vec3 translatorToVec(const kln::translator& t);
+kln::translator vecToTranslator(const glm::vec3& v);